@@ -16,35 +16,6 @@ void errCallback(int, const char *err) { std::cerr << err << std::endl; }
 
 } // namespace
 
-/// numGradVecs needs to be a power of 2
-std::unique_ptr<double[]> getGradVecs(std::size_t numGradVecs,
-                                      std::size_t numDims, unsigned seed) {
-  std::unique_ptr<double[]> gradVecs(new double[numGradVecs * numDims]);
-  std::mt19937 mtrand(seed);
-  double pi2 = 2 * 3.141592653589792653589793238462643383;
-  // assuming numGradVecs is even (which it is)
-  for (std::size_t i = 0; i < numGradVecs * numDims; i += 2) {
-    double u1 = (1 - mtrand() / 4294967296.0);
-    double u2 = (1 - mtrand() / 4294967296.0);
-    double r = std::sqrt(-2 * std::log(u1));
-    gradVecs[i] = r * std::cos(pi2 * u2);
-    gradVecs[i + 1] = r * std::sin(pi2 * u2);
-  }
-  for (std::size_t i = 0; i < numGradVecs; i++) {
-    double norm = 0;
-    for (std::size_t j = 0; j < numDims; j++) {
-      norm += gradVecs[numDims * i + j] * gradVecs[numDims * i + j];
-    }
-    // the likelihood of norm being less than 1e-12 in 3 dimensions
-    // (chi-squared random variable) is insanely small
-    norm = std::sqrt(norm);
-    for (std::size_t j = 0; j < numDims; j++) {
-      gradVecs[numDims * i + j] /= norm;
-    }
-  }
-  return gradVecs;
-}
-
 int main() {
   glfwSetErrorCallback(&errCallback);
   if (!glfwInit()) {
@@ -102,12 +73,13 @@ int main() {
   // 1, 0}, 1, 1};
   std::size_t numGradVecs = 4096;
   unsigned seed = 2;
-  std::unique_ptr<double[]> gradVecs = getGradVecs(numGradVecs, 4, seed);
+  std::unique_ptr<double[]> gradVecs =
+      hypervoxel::getGradVecs(numGradVecs, 4, seed);
   hypervoxel::TerrainRenderer<4, hypervoxel::TerrainGeneratorPerlin<4>>
       renderer(
           hypervoxel::TerrainGeneratorPerlin<4>{
               {{32, 32, 32, 32}, gradVecs.get(), numGradVecs - 1, 3, 0.5}},
-          100000, 600000, 100000, 4, pdists, sd);
+          6250, 37500, 100000, 4, pdists, sd);
   const std::size_t lenTriangles = 21 * 1048576;
   std::unique_ptr<float[]> triangles(new float[lenTriangles]);
   float *triangles_end = triangles.get() + lenTriangles;
@@ -0,0 +1,403 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "concurrent_hashtable.hpp"
+#include "vector.hpp"
+
+typedef hypervoxel::ConcurrentHashMapNoResize<std::uint64_t, std::uint64_t,
+                                              std::hash<std::uint64_t>,
+                                              std::equal_to<std::uint64_t>>
+    map_t;
+
+/// a few keys that every thread hits, like terrain right around the camera
+const std::size_t numHotKeys = 64;
+const double secsPerRun = 0.2;
+
+struct Reader {
+
+  map_t *map;
+  const std::atomic<bool> *stop;
+  bool optimistic;
+  std::size_t seed;
+  std::size_t ops;
+
+  void operator()() {
+    std::uint64_t x = seed * 0x9e3779b97f4a7c15ULL + 1;
+    std::uint64_t sum = 0;
+    ops = 0;
+    while (!stop->load(std::memory_order_relaxed)) {
+      for (std::size_t j = 256; j--;) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        std::uint64_t k = x % numHotKeys;
+        auto fun = [](std::uint64_t &v) -> std::uint64_t { return v; };
+        sum += optimistic ? map->readIfFound(k, fun, 0)
+                          : map->runIfFound(k, fun, 0);
+      }
+      ops += 256;
+    }
+    if (sum == 1) {
+      std::cout << "(unlikely)" << std::endl;
+    }
+  }
+};
+
+double measureReads(map_t &map, std::size_t numThreads, bool optimistic) {
+  std::atomic<bool> stop{false};
+  std::unique_ptr<Reader[]> readers(new Reader[numThreads]);
+  std::unique_ptr<std::thread[]> ts(new std::thread[numThreads]);
+  for (std::size_t i = numThreads; i--;) {
+    readers[i] = Reader{&map, &stop, optimistic, i + 1, 0};
+    ts[i] = std::thread(std::ref(readers[i]));
+  }
+  auto beg = std::chrono::steady_clock::now();
+  std::this_thread::sleep_for(std::chrono::duration<double>(secsPerRun));
+  stop.store(true, std::memory_order_relaxed);
+  std::size_t total = 0;
+  for (std::size_t i = numThreads; i--;) {
+    ts[i].join();
+    total += readers[i].ops;
+  }
+  double secs = std::chrono::duration_cast<std::chrono::duration<double>>(
+                    std::chrono::steady_clock::now() - beg)
+                    .count();
+  return total / secs;
+}
+
+std::uint64_t splitmix(std::uint64_t &x) {
+  std::uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/// average probe length and lookup time for hits and misses at a given load
+template <class Map> void probeBench(const char *layout, double load) {
+  const std::size_t sizeBits = 16;
+  const std::size_t numLookups = 1 << 20;
+  Map map(sizeBits);
+  std::size_t numKeys = load * (std::size_t(1) << sizeBits);
+  std::uint64_t x = 1;
+  std::unique_ptr<std::uint64_t[]> keys(new std::uint64_t[numKeys]);
+  for (std::size_t i = numKeys; i--;) {
+    keys[i] = splitmix(x);
+    map.findAndRun(keys[i], [i](std::uint64_t &v, bool) -> void { v = i; });
+  }
+  std::unique_ptr<std::uint64_t[]> misses(new std::uint64_t[numKeys]);
+  for (std::size_t i = numKeys; i--;) {
+    misses[i] = splitmix(x);
+  }
+  double probes[2] = {0, 0};
+  double nanos[2] = {0, 0};
+  std::uint64_t sum = 0;
+  for (int miss = 0; miss < 2; miss++) {
+    const std::uint64_t *ks = miss ? misses.get() : keys.get();
+    for (std::size_t i = numKeys; i--;) {
+      probes[miss] += map.probeLength(ks[i]);
+    }
+    probes[miss] /= numKeys;
+    auto beg = std::chrono::steady_clock::now();
+    for (std::size_t i = numLookups; i--;) {
+      sum += map.readIfFound(
+          ks[(i * 40503) % numKeys],
+          [](std::uint64_t &v) -> std::uint64_t { return v; }, 0);
+    }
+    nanos[miss] = std::chrono::duration_cast<std::chrono::duration<double>>(
+                      std::chrono::steady_clock::now() - beg)
+                      .count() *
+                  1e9 / numLookups;
+  }
+  std::cout << layout << "\t" << load << "\t" << probes[0] << "\t"
+            << probes[1] << "\t" << nanos[0] << "\t" << nanos[1]
+            << (sum == 1 ? "\t(unlikely)" : "") << std::endl;
+}
+
+/// terrain coordinates, keyed like TerrainCache keys them
+typedef hypervoxel::v::IVec<4> coord_t;
+typedef hypervoxel::v::IVecHash<4> coord_hash_t;
+typedef hypervoxel::v::EqualFunctor<coord_t, coord_t> coord_eq_t;
+
+const std::size_t matrixSizeBits = 16;
+const std::size_t maxThreads = 8;
+/// keys each thread cycles through, drawn before timing starts
+const std::size_t streamLen = 1 << 16;
+const double secsPerCell = 0.05;
+
+enum class KeyDist { uniform, zipf, walk };
+
+const char *distName(KeyDist dist) {
+  return dist == KeyDist::uniform ? "uniform"
+                                  : dist == KeyDist::zipf ? "zipf" : "walk";
+}
+
+/**
+  The keys of one matrix cell: every coordinate of a 16x16x16xn box, with n
+  picked for the load, which is what gets prefilled, and a stream per thread
+  drawn from it. Uniform draws any of them, zipf draws the box's coordinates
+  in a shuffled order with Zipf(0.99) popularity, and walk steps to a
+  neighbour in a random dimension each time (wrapping at the box's faces),
+  the way a DDA walks along a line.
+*/
+struct KeySet {
+  int sides[4];
+  std::vector<coord_t> universe;
+  std::vector<coord_t> streams[maxThreads];
+
+  KeySet(double load, KeyDist dist)
+      : sides{16, 16, 16, int(load * (1 << matrixSizeBits) / 4096 + 0.5)} {
+    for (int i = 0; i < sides[0] * sides[1] * sides[2] * sides[3]; i++) {
+      coord_t c;
+      for (int d = 0, rest = i; d < 4; rest /= sides[d++]) {
+        c[d] = rest % sides[d];
+      }
+      universe.push_back(c);
+    }
+    std::mt19937_64 gen(1);
+    std::shuffle(universe.begin(), universe.end(), gen);
+    std::vector<double> cdf;
+    if (dist == KeyDist::zipf) {
+      double sum = 0;
+      for (std::size_t i = 0; i < universe.size(); i++) {
+        sum += 1 / std::pow(i + 1, 0.99);
+        cdf.push_back(sum);
+      }
+    }
+    std::uniform_int_distribution<std::size_t> anyKey(0, universe.size() - 1);
+    std::uniform_real_distribution<double> unit(0, 1);
+    for (std::size_t t = maxThreads; t--;) {
+      coord_t c = universe[anyKey(gen)];
+      for (std::size_t i = streamLen; i--;) {
+        if (dist == KeyDist::uniform) {
+          c = universe[anyKey(gen)];
+        } else if (dist == KeyDist::zipf) {
+          c = universe[std::lower_bound(cdf.begin(), cdf.end(),
+                                        unit(gen) * cdf.back()) -
+                       cdf.begin()];
+        } else {
+          std::size_t g = gen();
+          std::size_t d = g & 3;
+          c[d] = (c[d] + (g & 4 ? 1 : sides[d] - 1)) % sides[d];
+        }
+        streams[t].push_back(c);
+      }
+    }
+  }
+
+  double load() const {
+    return double(universe.size()) / (1 << matrixSizeBits);
+  }
+};
+
+/// Common face of everything the matrix times: read() looks a key up,
+/// write() stores to it (inserting it if the structure lets go of keys).
+template <class Mutex> struct MapUnderTest {
+  hypervoxel::ConcurrentHashMapNoResize<coord_t, std::uint64_t, coord_hash_t,
+                                        coord_eq_t, Mutex>
+      map;
+
+  MapUnderTest() : map(matrixSizeBits) {}
+
+  std::uint64_t read(const coord_t &k) {
+    return map.readIfFound(
+        k, [](std::uint64_t &v) -> std::uint64_t { return v; }, 0);
+  }
+  void write(const coord_t &k, std::uint64_t val) {
+    map.findAndRun(k, [val](std::uint64_t &v, bool) -> void { v = val; });
+  }
+};
+
+/// Reads fall back to findAndRun on a miss, the way TerrainCache fills
+/// itself. Holds at most 3/4 of the map's slots, so at the highest load the
+/// box does not fit.
+struct CacherUnderTest {
+  hypervoxel::ConcurrentCacher<coord_t, std::uint64_t, coord_hash_t,
+                               coord_eq_t>
+      cache;
+
+  CacherUnderTest()
+      : cache(matrixSizeBits, (1 << matrixSizeBits) / 4,
+              (1 << matrixSizeBits) / 2) {}
+
+  std::uint64_t read(const coord_t &k) {
+    std::uint64_t got = cache.runIfFound(
+        k, [](std::uint64_t &v) -> std::uint64_t { return v; }, 0);
+    if (got) {
+      return got;
+    }
+    return cache.findAndRun(
+        k, [&k](std::uint64_t &v, bool isNew) -> std::uint64_t {
+          if (isNew) {
+            v = std::uint64_t(k[0]) + 1;
+          }
+          return v;
+        });
+  }
+  void write(const coord_t &k, std::uint64_t val) {
+    cache.findAndRun(k, [val](std::uint64_t &v, bool) -> void { v = val; });
+  }
+};
+
+/// the baseline: one std::mutex around a std::unordered_map
+struct LockedMapUnderTest {
+  std::mutex lock;
+  std::unordered_map<coord_t, std::uint64_t, coord_hash_t, coord_eq_t> map;
+
+  std::uint64_t read(const coord_t &k) {
+    std::lock_guard<std::mutex> ll(lock);
+    auto it = map.find(k);
+    return it == map.end() ? 0 : it->second;
+  }
+  void write(const coord_t &k, std::uint64_t val) {
+    std::lock_guard<std::mutex> ll(lock);
+    map[k] = val;
+  }
+};
+
+template <class Structure> struct MixedWorker {
+
+  Structure *structure;
+  const std::vector<coord_t> *stream;
+  const std::atomic<bool> *stop;
+  /// reads out of 256 ops
+  std::uint64_t reads;
+  std::size_t seed;
+  std::size_t ops;
+
+  void operator()() {
+    std::uint64_t x = seed * 0x9e3779b97f4a7c15ULL + 1;
+    std::uint64_t sum = 0;
+    std::size_t at = 0;
+    ops = 0;
+    while (!stop->load(std::memory_order_relaxed)) {
+      for (std::size_t j = 256; j--;) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        const coord_t &k = (*stream)[at];
+        at = at + 1 == streamLen ? 0 : at + 1;
+        if ((x & 255) < reads) {
+          sum += structure->read(k);
+        } else {
+          structure->write(k, x | 1);
+        }
+      }
+      ops += 256;
+    }
+    if (sum == 1) {
+      std::cout << "(unlikely)" << std::endl;
+    }
+  }
+};
+
+/// ops/sec of numThreads threads running the mix on a freshly filled
+/// Structure
+template <class Structure>
+double measureMix(const KeySet &keys, double readFrac,
+                  std::size_t numThreads) {
+  std::unique_ptr<Structure> structure(new Structure);
+  for (std::size_t i = 0; i < keys.universe.size(); i++) {
+    structure->write(keys.universe[i], i + 1);
+  }
+  std::atomic<bool> stop{false};
+  std::unique_ptr<MixedWorker<Structure>[]> workers(
+      new MixedWorker<Structure>[numThreads]);
+  std::unique_ptr<std::thread[]> ts(new std::thread[numThreads]);
+  for (std::size_t i = numThreads; i--;) {
+    workers[i] = MixedWorker<Structure>{structure.get(), &keys.streams[i],
+                                        &stop, std::uint64_t(readFrac * 256),
+                                        i + 1, 0};
+    ts[i] = std::thread(std::ref(workers[i]));
+  }
+  auto beg = std::chrono::steady_clock::now();
+  std::this_thread::sleep_for(std::chrono::duration<double>(secsPerCell));
+  stop.store(true, std::memory_order_relaxed);
+  std::size_t total = 0;
+  for (std::size_t i = numThreads; i--;) {
+    ts[i].join();
+    total += workers[i].ops;
+  }
+  double secs = std::chrono::duration_cast<std::chrono::duration<double>>(
+                    std::chrono::steady_clock::now() - beg)
+                    .count();
+  return total / secs;
+}
+
+template <class Structure>
+void mixRow(const char *structure, const KeySet &keys, KeyDist dist) {
+  for (double readFrac : {1.0, 0.9, 0.5}) {
+    for (std::size_t numThreads = 1; numThreads <= maxThreads;
+         numThreads *= 2) {
+      std::cout << structure << "\t" << distName(dist) << "\t" << keys.load()
+                << "\t" << readFrac << "\t" << numThreads << "\t"
+                << measureMix<Structure>(keys, readFrac, numThreads)
+                << std::endl;
+    }
+  }
+}
+
+template <class Mutex>
+using layout_t =
+    hypervoxel::ConcurrentHashMapNoResize<std::uint64_t, std::uint64_t,
+                                          std::hash<std::uint64_t>,
+                                          std::equal_to<std::uint64_t>, Mutex>;
+
+int main() {
+  std::ios_base::sync_with_stdio(false);
+  map_t map(16);
+  for (std::uint64_t k = 0; k < 30000; k++) {
+    map.findAndRun(k, [k](std::uint64_t &v, bool) -> void { v = k + 1; });
+  }
+
+  std::cout << "# read scaling on " << numHotKeys << " hot keys, "
+            << std::thread::hardware_concurrency() << " hardware threads"
+            << std::endl;
+  std::cout << "threads\tlocked_ops_per_sec\toptimistic_ops_per_sec"
+            << std::endl;
+  for (std::size_t numThreads = 1; numThreads <= 64; numThreads *= 2) {
+    double locked = measureReads(map, numThreads, false);
+    double optimistic = measureReads(map, numThreads, true);
+    std::cout << numThreads << "\t" << locked << "\t" << optimistic
+              << std::endl;
+  }
+
+  std::cout << std::endl
+            << "# probe length (slots, or groups of 16 for grouped) and "
+               "lookup time"
+            << std::endl;
+  std::cout << "layout\tload\thit_probes\tmiss_probes\thit_ns\tmiss_ns"
+            << std::endl;
+  for (double load : {0.5, 0.75, 0.9}) {
+    probeBench<layout_t<std::mutex>>("entry", load);
+    probeBench<layout_t<hypervoxel::SpinTagLock>>("compact", load);
+    probeBench<layout_t<hypervoxel::GroupTagLock>>("grouped", load);
+  }
+
+  std::cout << std::endl
+            << "# ops/sec over a 2^" << matrixSizeBits
+            << " slot table prefilled with a box of coordinates, cacher "
+               "holding 3/4 of that"
+            << std::endl;
+  std::cout << "structure\tdist\tload\tread_frac\tthreads\tops_per_sec"
+            << std::endl;
+  for (KeyDist dist : {KeyDist::uniform, KeyDist::zipf, KeyDist::walk}) {
+    for (double load : {0.5, 0.75, 0.9}) {
+      KeySet keys(load, dist);
+      mixRow<MapUnderTest<std::mutex>>("entry", keys, dist);
+      mixRow<MapUnderTest<hypervoxel::GroupTagLock>>("grouped", keys, dist);
+      mixRow<CacherUnderTest>("cacher", keys, dist);
+      mixRow<LockedMapUnderTest>("locked_umap", keys, dist);
+    }
+  }
+}
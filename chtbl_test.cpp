@@ -1,5 +1,6 @@
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <thread>
 
 #include "concurrent_hashtable.hpp"
@@ -29,6 +30,129 @@ template <class CMap> struct ThreadFun {
   };
 };
 
+/// fills one of the alternative layouts from many threads, then reads back
+template <class Mutex>
+void checkLayout(std::size_t sizeBits, std::size_t numThreads,
+                 hypervoxel::TableAlloc alloc = hypervoxel::TableAlloc::eager) {
+  hypervoxel::ConcurrentHashMapNoResize<int, int, std::hash<int>,
+                                        std::equal_to<int>, Mutex>
+      cmap(sizeBits, alloc);
+  auto cfun = [&cmap](std::size_t i) -> void {
+    for (std::size_t j = 10; j--;) {
+      int val = i + j * 100;
+      cmap.findAndRun(256 * i, [val](int &v, bool) -> void { v = val; });
+      cmap.findAndRun(256 * i + 131072,
+                      [val](int &v, bool) -> void { v = val; });
+    }
+  };
+  std::unique_ptr<std::thread[]> ts(new std::thread[numThreads]);
+  for (std::size_t i = numThreads; i--;) {
+    ts[i] = std::thread(cfun, i + 1);
+  }
+  cfun(numThreads + 1);
+  for (std::size_t i = numThreads; i--;) {
+    ts[i].join();
+  }
+  std::size_t count = 0;
+  for (std::size_t i = 1; i <= numThreads + 1; i++) {
+    for (int k : {int(256 * i), int(256 * i + 131072)}) {
+      int locked = cmap.runIfFound(k, [](int &v) -> int { return v; }, -1);
+      int optimistic =
+          cmap.readIfFound(k, [](int &v) -> int { return v; }, -1);
+      if (locked < 0 || std::size_t(locked) % 100 != i ||
+          optimistic != locked) {
+        std::cout << "INVALID!!! " << k << ": " << locked << " "
+                  << optimistic << std::endl;
+      }
+      count++;
+    }
+  }
+  std::cout << "CHECKED ELEMENTS: " << count << std::endl;
+  hypervoxel::TableStats stats = cmap.stats();
+  std::cout << "PROBES:";
+  for (std::uint64_t n : stats.probeHist) {
+    std::cout << " " << n;
+  }
+  std::cout << " BLOCKED: " << stats.blockedLocks
+            << " LOAD: " << stats.loadFactor << std::endl;
+  if (stats.inserts != count || stats.hits + stats.misses != 12 * count) {
+    std::cout << "INVALID!!! stats " << stats.inserts << " " << stats.hits
+              << " " << stats.misses << std::endl;
+  }
+}
+
+/// erases and reinserts keys from some threads while the others keep finding
+/// the keys that stay, then checks that the stayers sit where they would had
+/// nothing else ever been inserted
+template <class Mutex> void checkErase(std::size_t sizeBits) {
+  typedef hypervoxel::ConcurrentHashMapNoResize<int, int, std::hash<int>,
+                                                std::equal_to<int>, Mutex>
+      map_t;
+  const int numStable = 64;
+  const std::size_t numChurners = 4;
+  const int keysPerChurner = 16;
+  map_t cmap(sizeBits);
+  map_t fresh(sizeBits);
+  // four stable keys share each of 16 home buckets, the churned keys land
+  // right after them
+  auto stable = [](int i) -> int { return 256 * i + 8 * (i % 16); };
+  for (int i = 0; i < numStable; i++) {
+    cmap.findAndRun(stable(i), [i](int &v, bool) -> void { v = i; });
+    fresh.findAndRun(stable(i), [i](int &v, bool) -> void { v = i; });
+  }
+  std::atomic<std::size_t> churning{numChurners};
+  std::atomic<std::size_t> bad{0};
+  auto churn = [&cmap, &churning, &bad](int t) -> void {
+    for (int round = 0; round < 200; round++) {
+      for (int j = 0; j < keysPerChurner; j++) {
+        int k = 256 * (j + 1) + 8 * (round % 16) + t + 1;
+        cmap.findAndRun(k, [k](int &v, bool) -> void { v = k; });
+      }
+      for (int j = 0; j < keysPerChurner; j++) {
+        int k = 256 * (j + 1) + 8 * (round % 16) + t + 1;
+        if (!cmap.erase(k) || cmap.erase(k)) {
+          bad.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+    }
+    churning.fetch_sub(1, std::memory_order_relaxed);
+  };
+  auto read = [&cmap, &churning, &bad, &stable]() -> void {
+    while (churning.load(std::memory_order_relaxed)) {
+      for (int i = 0; i < numStable; i++) {
+        if (cmap.runIfFound(stable(i), [](int &v) -> int { return v; }, -1) !=
+                i ||
+            cmap.findAndRun(stable(i), [](int &, bool isNew) -> bool {
+              return isNew;
+            })) {
+          bad.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+    }
+  };
+  std::thread ts[2 * numChurners];
+  for (std::size_t i = numChurners; i--;) {
+    ts[i] = std::thread(churn, int(i));
+    ts[numChurners + i] = std::thread(read);
+  }
+  for (std::thread &t : ts) {
+    t.join();
+  }
+  std::size_t probes = 0, freshProbes = 0;
+  for (int i = 0; i < numStable; i++) {
+    probes += cmap.probeLength(stable(i));
+    freshProbes += fresh.probeLength(stable(i));
+  }
+  hypervoxel::TableStats stats = cmap.stats();
+  std::cout << "ERASED: " << stats.erases << " PROBES: " << probes << " / "
+            << freshProbes << std::endl;
+  if (bad.load() || probes != freshProbes ||
+      stats.inserts - stats.erases != std::size_t(numStable) ||
+      cmap.runIfFound(257, [](int &v) -> int { return v; }, -1) != -1) {
+    std::cout << "INVALID!!! erase " << bad.load() << std::endl;
+  }
+}
+
 int main() {
   std::ios_base::sync_with_stdio(false);
   const std::size_t numThreads = 64;
@@ -81,5 +205,152 @@ int main() {
         },
         0);
   }
-}
 
+  std::cout << std::endl << std::endl << std::endl << std::endl << std::endl;
+
+  // ---------------------------------------
+
+  hypervoxel::ConcurrentHashMap<int, int, std::hash<int>, std::equal_to<int>>
+      gmap(2);
+  auto gfun = [&gmap](std::size_t i) -> void {
+    for (std::size_t j = 10; j--;) {
+      int val = i + j * 100;
+      gmap.findAndRun(256 * i, [val](int &v, bool) -> void { v = val; });
+      gmap.findAndRun(256 * i + 131072,
+                      [val](int &v, bool) -> void { v = val; });
+    }
+  };
+  for (std::size_t i = numThreads; i--;) {
+    ts[i] = std::thread(gfun, i + 1);
+  }
+  gfun(numThreads + 1);
+  for (std::size_t i = numThreads; i--;) {
+    ts[i].join();
+  }
+  std::size_t gcount = 0;
+  for (std::size_t i = 1; i <= numThreads + 1; i++) {
+    for (int k : {int(256 * i), int(256 * i + 131072)}) {
+      int found = gmap.runIfFound(k, [](int &v) -> int { return v; }, -1);
+      if (found < 0 || std::size_t(found) % 100 != i) {
+        std::cout << "INVALID!!! " << k << ": " << found << std::endl;
+      }
+    }
+  }
+  gmap.forEach([&gcount](std::pair<int, int> &) -> bool {
+    gcount++;
+    return true;
+  });
+  std::cout << "GROWN TO: " << gmap.capacity() << std::endl;
+  std::cout << "TOTAL ELEMENTS: " << gcount << std::endl;
+  int bkeys[] = {256, 512 + 131072, 7, 768, 9};
+  int bfound[] = {-1, -1, -1, -1, -1};
+  gmap.runIfFoundBatch(bkeys, 5, [&bfound](std::size_t i, int &v) -> void {
+    bfound[i] = v;
+  });
+  gmap.findAndRunBatch(bkeys, 5, [&bfound](std::size_t i, int &v,
+                                           bool isNew) -> void {
+    if (isNew != (bfound[i] < 0) || (!isNew && v != bfound[i])) {
+      std::cout << "INVALID!!! batch " << i << std::endl;
+    }
+  });
+  if (bfound[0] % 100 != 1 || bfound[1] % 100 != 2 || bfound[2] != -1) {
+    std::cout << "INVALID!!! runIfFoundBatch" << std::endl;
+  }
+  gmap.clear();
+  gmap.acquireClear();
+  gcount = 0;
+  gmap.forEach([&gcount](std::pair<int, int> &) -> bool {
+    gcount++;
+    return true;
+  });
+  if (gcount || gmap.runIfFound(256, [](int &v) -> int { return v; }, -1) !=
+                    -1) {
+    std::cout << "INVALID!!! clear left " << gcount << std::endl;
+  }
+  // many threads growing a tiny table at once, so inserts keep landing in
+  // tables whose predecessor some descheduled thread is still migrating
+  for (int round = 0; round < 8; round++) {
+    hypervoxel::ConcurrentHashMap<int, int, std::hash<int>,
+                                  std::equal_to<int>>
+        smap(2);
+    auto sfun = [&smap](std::size_t i) -> void {
+      for (int j = 0; j < 200; j++) {
+        smap.findAndRun(int(1000 * i) + j, [](int &v, bool) -> void { v++; });
+      }
+    };
+    for (std::size_t i = numThreads; i--;) {
+      ts[i] = std::thread(sfun, i);
+    }
+    for (std::size_t i = numThreads; i--;) {
+      ts[i].join();
+    }
+    std::size_t scount = 0;
+    smap.forEach([&scount](std::pair<int, int> &e) -> bool {
+      scount += e.second == 1;
+      return true;
+    });
+    if (scount != numThreads * 200) {
+      std::cout << "INVALID!!! grown " << scount << std::endl;
+    }
+  }
+
+  std::cout << std::endl << std::endl << std::endl << std::endl << std::endl;
+
+  // ---------------------------------------
+
+  checkLayout<hypervoxel::SpinTagLock>(sizeBits, numThreads);
+  checkLayout<hypervoxel::GroupTagLock>(sizeBits, numThreads);
+  checkLayout<hypervoxel::SpinTagLock>(sizeBits, numThreads,
+                                       hypervoxel::TableAlloc::zeroPages);
+  checkLayout<hypervoxel::GroupTagLock>(
+      sizeBits, numThreads, hypervoxel::TableAlloc::hugeZeroPages);
+  checkErase<std::mutex>(sizeBits);
+  checkErase<hypervoxel::SpinTagLock>(sizeBits);
+  checkErase<hypervoxel::GroupTagLock>(sizeBits);
+
+  std::cout << std::endl << std::endl << std::endl << std::endl << std::endl;
+
+  // ---------------------------------------
+
+  hypervoxel::ClockCacher<int, int, std::hash<int>, std::equal_to<int>, true>
+      ccache(csizeBits, cminSize, cmaxSize);
+  auto ccfun = [&ccache](std::size_t i) -> void {
+    for (std::size_t j = 0; j < 2000; j++) {
+      int k = (i * 7919 + j * j) % 600;
+      int got = ccache.runIfFound(k, [](int &v) -> int { return v; }, -1);
+      if (got < 0) {
+        got = ccache.findAndRun(k, [k](int &v, bool isNew) -> int {
+          if (isNew) {
+            v = 3 * k;
+          }
+          return v;
+        });
+      }
+      if (got != 3 * k) {
+        std::cout << "INVALID!!! " << k << ": " << got << std::endl;
+      }
+    }
+  };
+  for (std::size_t i = numThreads; i--;) {
+    ts[i] = std::thread(ccfun, i + 1);
+  }
+  ccfun(numThreads + 1);
+  for (std::size_t i = numThreads; i--;) {
+    ts[i].join();
+  }
+  ccache.insertAndRun(1000, [](int &v, bool) -> void { v = 7; });
+  if (ccache.runIfFound(1000, [](int &v) -> int { return v; }, -1) != 7) {
+    std::cout << "INVALID!!! insertAndRun did not keep its entry" << std::endl;
+  }
+  ccache.runIfFound(1000, [](int &v) -> int { return v = 8; }, -1);
+  if (ccache.readIfFound(1000, [](int &v) -> int { return v; }, -1) != 8) {
+    std::cout << "INVALID!!! runIfFound did not write in place" << std::endl;
+  }
+  hypervoxel::TableStats cstats = ccache.stats();
+  std::cout << "CLOCK HITS: " << cstats.hits << " MISSES: " << cstats.misses
+            << " EVICTIONS: " << cstats.evictions
+            << " REJECTIONS: " << cstats.rejections << std::endl;
+  if (cstats.hits + cstats.misses != (numThreads + 1) * 2000 + 4) {
+    std::cout << "INVALID!!! lookups went uncounted" << std::endl;
+  }
+}
@@ -2,10 +2,21 @@
 #define HYPERVOXEL_CONCURRENT_HASHTABLE_HPP_
 
 #include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <memory>
 #include <mutex>
+#include <new>
+#include <sys/mman.h>
+#include <thread>
+#include <type_traits>
 #include <utility>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace hypervoxel {
 
 inline int ceilLog2(std::uint64_t v) {
@@ -25,71 +36,1730 @@ inline int ceilLog2(std::uint64_t v) {
   return tab64[((std::uint64_t)((v - (v >> 1)) * 0x07EDD5E59A4E28C2)) >> 58];
 }
 
-template <class K, class V, class Hash, class Eq, class Mutex = std::mutex>
-struct ConcurrentHashMapNoResize {
+/**
+  Counts from one table or cacher, see stats() on each. Everything is zero
+  unless built with HYPERVOXEL_CHTBL_STATS defined.
+*/
+struct TableStats {
+  static const std::size_t histSize = 8;
+
+  /// probeHist[i] counts lookups that looked at 2^i to 2^(i+1)-1 buckets
+  /// (groups for the grouped layout, always 1 set for ClockCacher), the last
+  /// one also all longer ones
+  std::uint64_t probeHist[histSize];
+  /// lock acquisitions that had to wait for another thread
+  std::uint64_t blockedLocks;
+  std::uint64_t inserts;
+  std::uint64_t erases;
+  std::uint64_t hits;
+  std::uint64_t misses;
+  /// cached entries dropped to make room for others
+  std::uint64_t evictions;
+  /// missed entries that admission did not keep
+  std::uint64_t rejections;
+  /// times a ConcurrentCacher dropped its older table
+  std::uint64_t flips;
+  /// entries over buckets, of the fullest table
+  double loadFactor;
+
+  TableStats &operator+=(const TableStats &o) {
+    for (std::size_t i = histSize; i--;) {
+      probeHist[i] += o.probeHist[i];
+    }
+    blockedLocks += o.blockedLocks;
+    inserts += o.inserts;
+    erases += o.erases;
+    hits += o.hits;
+    misses += o.misses;
+    evictions += o.evictions;
+    rejections += o.rejections;
+    flips += o.flips;
+    loadFactor = o.loadFactor > loadFactor ? o.loadFactor : loadFactor;
+    return *this;
+  }
+};
+
+#ifdef HYPERVOXEL_CHTBL_STATS
+
+/// Relaxed counter spread over cache lines. Each thread adds to its own shard,
+/// so counting every lookup does not make all threads fight over one line.
+class ShardedCounter {
+
+  static const std::size_t numShards = 16;
+
+  struct Shard {
+    std::atomic<std::uint64_t> n;
+    char pad[64 - sizeof(std::atomic<std::uint64_t>)];
+  };
+
+  Shard shards[numShards];
+
+  static std::size_t shardIndex() {
+    static std::atomic<std::size_t> nextIndex{0};
+    static thread_local std::size_t index =
+        nextIndex.fetch_add(1, std::memory_order_relaxed) % numShards;
+    return index;
+  }
+
+public:
+  ShardedCounter() {
+    for (std::size_t i = numShards; i--;) {
+      shards[i].n.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  void add(std::uint64_t d = 1) {
+    shards[shardIndex()].n.fetch_add(d, std::memory_order_relaxed);
+  }
+
+  std::uint64_t load() const {
+    std::uint64_t toreturn = 0;
+    for (std::size_t i = numShards; i--;) {
+      toreturn += shards[i].n.load(std::memory_order_relaxed);
+    }
+    return toreturn;
+  }
+};
+
+/// what the tables count with HYPERVOXEL_CHTBL_STATS, see TableStats
+class TableCounters {
+
+  ShardedCounter probeHist[TableStats::histSize];
+  ShardedCounter blockedLocks, inserts, erases, hits, misses, evictions,
+      rejections, flips;
+  /// inserts - erases as of the last clear
+  std::atomic<std::uint64_t> liveAtClear;
+
+public:
+  TableCounters() : liveAtClear{0} {}
+  /// only there so tables stay movable, a moved table counts from zero
+  TableCounters(const TableCounters &) : liveAtClear{0} {}
+
+  void probed(std::size_t n) {
+    std::size_t bucket = 0;
+    while (n > 1 && bucket + 1 < TableStats::histSize) {
+      n >>= 1;
+      bucket++;
+    }
+    probeHist[bucket].add();
+  }
+
+  /// locks l, counting it if that has to wait
+  template <class Lock> void lock(Lock &l) {
+    if (!l.try_lock()) {
+      blockedLocks.add();
+      l.lock();
+    }
+  }
+
+  void blocked() { blockedLocks.add(); }
+  void inserted() { inserts.add(); }
+  void erased() { erases.add(); }
+  void hit() { hits.add(); }
+  void missed() { misses.add(); }
+  void evicted(std::uint64_t n = 1) { evictions.add(n); }
+  void rejected() { rejections.add(); }
+  void flipped() { flips.add(); }
+
+  /// entries inserted since and not erased are what loadFactor counts
+  void cleared() {
+    liveAtClear.store(inserts.load() - erases.load(),
+                      std::memory_order_relaxed);
+  }
+
+  TableStats snapshot(std::size_t capacity) const {
+    TableStats toreturn;
+    for (std::size_t i = TableStats::histSize; i--;) {
+      toreturn.probeHist[i] = probeHist[i].load();
+    }
+    toreturn.blockedLocks = blockedLocks.load();
+    toreturn.inserts = inserts.load();
+    toreturn.erases = erases.load();
+    toreturn.hits = hits.load();
+    toreturn.misses = misses.load();
+    toreturn.evictions = evictions.load();
+    toreturn.rejections = rejections.load();
+    toreturn.flips = flips.load();
+    toreturn.loadFactor =
+        double(toreturn.inserts - toreturn.erases -
+               liveAtClear.load(std::memory_order_relaxed)) /
+        capacity;
+    return toreturn;
+  }
+};
+
+#else
+
+/// compiles away without HYPERVOXEL_CHTBL_STATS
+struct TableCounters {
+  void probed(std::size_t) {}
+  template <class Lock> void lock(Lock &l) { l.lock(); }
+  void blocked() {}
+  void inserted() {}
+  void erased() {}
+  void hit() {}
+  void missed() {}
+  void evicted(std::uint64_t = 1) {}
+  void rejected() {}
+  void flipped() {}
+  void cleared() {}
+  TableStats snapshot(std::size_t) const { return TableStats(); }
+};
+
+#endif
+
+/// counts the buckets one lookup looks at, and records them once it is done
+struct ProbeCount {
+  TableCounters &counters;
+  std::size_t n;
+
+  ~ProbeCount() { counters.probed(n); }
+};
+
+/// Backs off an optimistic reader that found what it wants being written:
+/// spins for a while, then yields to the writer on every retry.
+inline void readBackoff(std::size_t spins) {
+  if (spins >= 64) {
+    std::this_thread::yield();
+  }
+}
+
+/// Spin lock on the low bit of a seqlock word. If written, unlocking bumps
+/// the rest of the word, which optimistic readers validate on.
+struct SeqLocker {
+  std::atomic<std::uint32_t> &word;
+  std::uint32_t seq;
+  bool written;
+
+  SeqLocker(std::atomic<std::uint32_t> &word, TableCounters &counters)
+      : word(word), seq(lock(word, counters)), written(false) {}
+  ~SeqLocker() {
+    word.store(written ? seq + 2 : seq, std::memory_order_release);
+  }
+
+  /// spins until the lock bit is ours, returns the word from before locking
+  static std::uint32_t lock(std::atomic<std::uint32_t> &word,
+                            TableCounters &counters) {
+    for (std::size_t spins = 0;; spins++) {
+      std::uint32_t seq = word.load(std::memory_order_relaxed);
+      if (!(seq & 1) &&
+          word.compare_exchange_weak(seq, seq | 1, std::memory_order_acquire,
+                                     std::memory_order_relaxed)) {
+        return seq;
+      }
+      if (!spins) {
+        counters.blocked();
+      }
+      if (spins >= 64) {
+        std::this_thread::yield();
+      }
+    }
+  }
+};
+
+/**
+  Sets a SeqLocker's written flag once a functor run on val under the lock
+  is done, but only if it changed val's bytes. Hits that only read then
+  leave the seqlock word as it was, so optimistic readers that overlapped
+  them need not retry. Values that are not trivially copyable always count
+  as written, but they have no optimistic readers anyway.
+*/
+template <class V, bool = std::is_trivially_copyable<V>::value>
+struct WriteDetector {
+  bool &written;
+  const V &val;
+  typename std::aligned_storage<sizeof(V), alignof(V)>::type before;
+
+  WriteDetector(bool &written, const V &val) : written(written), val(val) {
+    std::memcpy(&before, &val, sizeof(V));
+  }
+  ~WriteDetector() {
+    written = written || std::memcmp(&before, &val, sizeof(V));
+  }
+};
+template <class V> struct WriteDetector<V, false> {
+  WriteDetector(bool &written, const V &) { written = true; }
+};
+
+/**
+  Seqlock word of the NoResize layouts' erase, which holds it while shifting
+  entries back. A lookup that misses only trusts that if the word did not
+  change since the lookup started, as k may have been shifted back past
+  where it was looking. Copies start out unlocked, so tables stay movable.
+*/
+struct EraseSeq {
+  std::atomic<std::uint32_t> word;
+
+  EraseSeq() : word{0} {}
+  EraseSeq(const EraseSeq &) : word{0} {}
+
+  std::uint32_t read() const { return word.load(std::memory_order_acquire); }
+
+  /// whether nothing was erased since read() returned seq
+  bool validate(std::uint32_t seq) const {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return !(seq & 1) && word.load(std::memory_order_relaxed) == seq;
+  }
+
+  /// waits for the running erase, if any, to finish
+  std::uint32_t settle() const {
+    for (std::size_t spins = 0;; spins++) {
+      std::uint32_t seq = read();
+      if (!(seq & 1)) {
+        return seq;
+      }
+      if (spins >= 64) {
+        std::this_thread::yield();
+      }
+    }
+  }
+};
+
+/// frees arrays from alignedArray
+struct AlignedDeleter {
+  template <class T> void operator()(T *p) const { std::free(p); }
+};
+
+/// n default-initialized Ts starting on a cache line. T has to be trivially
+/// destructible, AlignedDeleter only frees the memory.
+template <class T> T *alignedArray(std::size_t n) {
+  void *mem = nullptr;
+  if (posix_memalign(&mem, 64, n * sizeof(T))) {
+    throw std::bad_alloc();
+  }
+  T *toreturn = static_cast<T *>(mem);
+  for (std::size_t i = n; i--;) {
+    ::new (toreturn + i) T;
+  }
+  return toreturn;
+}
+
+/**
+  Where a table's slots come from. eager allocates and initializes every slot
+  up front. zeroPages maps fresh anonymous memory instead, whose all-zero
+  slots already are empty ones: the table comes up without touching any of
+  it, and only the pages that get probed are ever committed. hugeZeroPages
+  also asks for transparent huge pages, for fewer TLB misses once the table
+  is warm. Layouts and types whose empty slots are not all zeros fall back
+  to eager, see each constructor.
+*/
+enum class TableAlloc { eager, zeroPages, hugeZeroPages };
+
+/// frees arrays from mappedArray, and with Eager the ones that were not
+/// mapped (bytes == 0)
+template <class Eager> struct MaybeMapped {
+  std::size_t bytes;
+
+  template <class T> void operator()(T *p) const {
+    if (bytes) {
+      munmap(p, bytes);
+    } else {
+      Eager()(p);
+    }
+  }
+};
+
+/// n Ts on fresh zero pages. Nothing is constructed, so T has to be fine
+/// starting out as all zeros, and nothing is destructed either.
+template <class T, class Eager>
+std::unique_ptr<T[], MaybeMapped<Eager>> mappedArray(std::size_t n,
+                                                     TableAlloc alloc) {
+  std::size_t bytes = n * sizeof(T);
+  void *mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (mem == MAP_FAILED) {
+    throw std::bad_alloc();
+  }
+#ifdef MADV_HUGEPAGE
+  if (alloc == TableAlloc::hugeZeroPages) {
+    madvise(mem, bytes, MADV_HUGEPAGE);
+  }
+#else
+  (void)alloc;
+#endif
+  return {static_cast<T *>(mem), MaybeMapped<Eager>{bytes}};
+}
+
+template <class T>
+using TableArray = std::unique_ptr<T[], MaybeMapped<std::default_delete<T[]>>>;
+
+/// n value-initialized Ts with new[], or mapped if alloc says so
+template <class T> TableArray<T> tableArray(std::size_t n, TableAlloc alloc) {
+  if (alloc == TableAlloc::eager) {
+    return {new T[n](), MaybeMapped<std::default_delete<T[]>>{0}};
+  }
+  return mappedArray<T, std::default_delete<T[]>>(n, alloc);
+}
+
+template <class K, class V, class Hash, class Eq, class Mutex = std::mutex>
+struct ConcurrentHashMapNoResize {
+
+  typedef std::pair<K, V> value_type;
+
+  static const std::size_t hashmask = std::size_t(1) << 31;
+
+  struct Entry {
+    Mutex lock;       /// Applies to r/w on value, just w on hash
+    value_type value; /// hash = (real hash) | hashmask, and unoccupied is 0
+    std::atomic<std::size_t> hash;
+    /// odd while a writer holding lock may be changing value
+    std::atomic<std::uint32_t> version;
+
+    Entry() : lock{}, value{}, hash{0}, version{0} {}
+  };
+
+  /// bumps an entry's version around a write, see readIfFound
+  struct VersionGuard {
+    std::atomic<std::uint32_t> &version;
+
+    explicit VersionGuard(std::atomic<std::uint32_t> &version)
+        : version(version) {
+      version.store(version.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+    ~VersionGuard() {
+      version.store(version.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+    }
+  };
+
+  std::size_t size;
+  std::size_t sizeMask;
+  std::unique_ptr<Entry[]> table;
+  Hash hasher;
+  Eq eqer;
+  EraseSeq erasing;
+  mutable TableCounters counters;
+
+  /// Entries hold a Mutex, so this layout always constructs them up front
+  /// and ignores alloc.
+  explicit ConcurrentHashMapNoResize(std::size_t sizeBits,
+                                     TableAlloc = TableAlloc::eager)
+      : size(1 << sizeBits), sizeMask(size - 1),
+        table(new Entry[size]), hasher{}, eqer{} {}
+
+  /// run acquireClear after running this
+  void clear() {
+    for (std::size_t i = 0; i < size; i++) {
+      table[i].hash.store(0, std::memory_order_relaxed);
+    }
+    counters.cleared();
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  /// run this in each thread after running clearNotThreadsafe
+  void acquireClear() { std::atomic_thread_fence(std::memory_order_acquire); }
+
+  /// Runs functor on each entry, to read it, holding the entry's lock, and
+  /// stops early if functor returns false. Entries inserted or erased
+  /// meanwhile may or may not be visited.
+  template <class F> void forEach(F &&functor) {
+    for (std::size_t i = 0; i < size; i++) {
+      Entry &e = table[i];
+      if (!e.hash.load(std::memory_order_relaxed)) {
+        continue;
+      }
+      std::lock_guard<Mutex> lock(e.lock);
+      if (e.hash.load(std::memory_order_relaxed) &&
+          !functor(const_cast<const value_type &>(e.value))) {
+        return;
+      }
+    }
+  }
+
+  template <class F>
+  decltype(std::declval<F>()(std::declval<V &>(), false))
+  findAndRun(const K &k, F &&functor) {
+    std::size_t kh = hasher(k);
+    std::size_t khm = kh | hashmask;
+    Entry *tptr = table.get();
+    ProbeCount pc{counters, 0};
+    std::uint32_t es = erasing.read();
+    while (true) {
+      for (std::size_t i = kh & sizeMask;; i = (i + 1) & sizeMask) {
+        pc.n++;
+        Entry *tmp = tptr + i;
+        std::size_t hash = tmp->hash.load(std::memory_order_relaxed);
+        if (hash == 0) {
+          std::unique_lock<Mutex> ll(tmp->lock, std::defer_lock);
+          counters.lock(ll);
+          hash = tmp->hash.load(std::memory_order_relaxed);
+          if (hash == 0 && !erasing.validate(es)) {
+            break;
+          }
+          if (hash != 0 && (hash != khm || !eqer(k, tmp->value.first))) {
+            // Another thread has stolen this bucket for their own key
+            continue;
+          }
+          VersionGuard vg(tmp->version);
+          if (hash == 0) {
+            tmp->hash.store(khm, std::memory_order_relaxed);
+            tmp->value.first = k;
+            ::new (&tmp->value.second) V{};
+            counters.missed();
+            counters.inserted();
+            return functor(tmp->value.second, true);
+          }
+          counters.hit();
+          return functor(tmp->value.second, false);
+        }
+        if (hash == khm) {
+          std::unique_lock<Mutex> ll(tmp->lock, std::defer_lock);
+          counters.lock(ll);
+          if (tmp->hash.load(std::memory_order_relaxed) == khm &&
+              eqer(k, tmp->value.first)) {
+            VersionGuard vg(tmp->version);
+            counters.hit();
+            return functor(tmp->value.second, false);
+          }
+        }
+      }
+      es = erasing.settle();
+    }
+  }
+
+  template <class F>
+  decltype(std::declval<F>()(std::declval<V &>()))
+  runIfFound(const K &k, F &&functor,
+             const decltype(functor(std::declval<V &>())) &def) {
+    std::size_t kh = hasher(k);
+    std::size_t khm = kh | hashmask;
+    Entry *tptr = table.get();
+    ProbeCount pc{counters, 0};
+    std::uint32_t es = erasing.read();
+    while (true) {
+      for (std::size_t i = kh & sizeMask;; i = (i + 1) & sizeMask) {
+        pc.n++;
+        Entry *tmp = tptr + i;
+        std::size_t hash = tmp->hash.load(std::memory_order_relaxed);
+        if (hash == 0) {
+          break;
+        }
+        if (hash == khm) {
+          std::unique_lock<Mutex> ll(tmp->lock, std::defer_lock);
+          counters.lock(ll);
+          if (tmp->hash.load(std::memory_order_relaxed) == khm &&
+              eqer(k, tmp->value.first)) {
+            VersionGuard vg(tmp->version);
+            counters.hit();
+            return functor(tmp->value.second);
+          }
+        }
+      }
+      if (erasing.validate(es)) {
+        counters.missed();
+        return def;
+      }
+      es = erasing.settle();
+    }
+  }
+
+  /**
+    Removes k, returning whether it was there. The entries after it in its
+    probe chain shift back to close the gap, so there are no tombstones and
+    probe chains stay as short as if k had never been inserted. Threadsafe,
+    but erases run one at a time, and lookups that miss while one is
+    shifting entries look again once it is done. V has to be move
+    assignable.
+  */
+  bool erase(const K &k) {
+    std::size_t kh = hasher(k);
+    std::size_t khm = kh | hashmask;
+    Entry *tptr = table.get();
+    SeqLocker el(erasing.word, counters);
+    for (std::size_t i = kh & sizeMask;; i = (i + 1) & sizeMask) {
+      Entry *tmp = tptr + i;
+      std::size_t hash = tmp->hash.load(std::memory_order_relaxed);
+      if (hash == 0) {
+        return false;
+      }
+      if (hash != khm) {
+        continue;
+      }
+      std::unique_lock<Mutex> ll(tmp->lock, std::defer_lock);
+      counters.lock(ll);
+      if (eqer(k, tmp->value.first)) {
+        el.written = true;
+        counters.erased();
+        shiftBack(i, ll);
+        return true;
+      }
+    }
+  }
+
+  /// pulls k's home bucket into cache ahead of a lookup
+  void prefetch(const K &k) const {
+    const Entry &e = table[hasher(k) & sizeMask];
+    __builtin_prefetch(&e, 1);
+    __builtin_prefetch(&e.hash, 1);
+  }
+
+  /// slots looked at to find k or rule it out. Not threadsafe.
+  std::size_t probeLength(const K &k) const {
+    std::size_t kh = hasher(k);
+    std::size_t khm = kh | hashmask;
+    std::size_t toreturn = 1;
+    for (std::size_t i = kh & sizeMask;; i = (i + 1) & sizeMask) {
+      std::size_t hash = table[i].hash.load(std::memory_order_relaxed);
+      if (!hash || toreturn > sizeMask ||
+          (hash == khm && eqer(k, table[i].value.first))) {
+        return toreturn;
+      }
+      toreturn++;
+    }
+  }
+
+  /**
+    Like runIfFound, but never takes a lock: the entry is copied out and the
+    copy is kept only if its version did not change meanwhile. functor gets
+    that copy, so writes to it are lost. An entry that is being written right
+    now is read again until the write is done, so k only misses once an
+    empty entry was seen with no write in flight.
+  */
+  template <class F>
+  decltype(std::declval<F>()(std::declval<V &>()))
+  readIfFound(const K &k, F &&functor,
+              const decltype(functor(std::declval<V &>())) &def) const {
+    static_assert(std::is_trivially_copyable<K>::value &&
+                      std::is_trivially_copyable<V>::value,
+                  "readIfFound copies entries bytewise");
+    std::size_t kh = hasher(k);
+    std::size_t khm = kh | hashmask;
+    const Entry *tptr = table.get();
+    ProbeCount pc{counters, 0};
+    std::uint32_t es = erasing.read();
+    while (true) {
+      for (std::size_t i = kh & sizeMask;; i = (i + 1) & sizeMask) {
+        pc.n++;
+        const Entry *tmp = tptr + i;
+        typename std::aligned_storage<sizeof(value_type),
+                                      alignof(value_type)>::type snap;
+        std::size_t hash = 0;
+        for (std::size_t spins = 0;; spins++) {
+          std::uint32_t version = tmp->version.load(std::memory_order_acquire);
+          if (!(version & 1)) {
+            hash = tmp->hash.load(std::memory_order_relaxed);
+            if (hash == khm) {
+              std::memcpy(&snap, &tmp->value, sizeof(value_type));
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (tmp->version.load(std::memory_order_relaxed) == version) {
+              break;
+            }
+          }
+          readBackoff(spins);
+        }
+        if (hash == 0) {
+          break;
+        }
+        if (hash != khm) {
+          continue;
+        }
+        value_type &val = *reinterpret_cast<value_type *>(&snap);
+        if (eqer(k, val.first)) {
+          counters.hit();
+          return functor(val.second);
+        }
+      }
+      if (erasing.validate(es)) {
+        counters.missed();
+        return def;
+      }
+      es = erasing.settle();
+    }
+  }
+
+  /// see TableStats. loadFactor counts the entries inserted since the last
+  /// clear() and not erased.
+  TableStats stats() const { return counters.snapshot(size); }
+
+private:
+  /// Empties the bucket at hole, which ll holds, moving later entries of the
+  /// run back into it as long as that keeps them at or after their home
+  /// bucket. Holds at most two bucket locks at a time, in probe order.
+  void shiftBack(std::size_t hole, std::unique_lock<Mutex> &ll) {
+    Entry *tptr = table.get();
+    std::unique_lock<Mutex> holeLock(std::move(ll));
+    for (std::size_t i = (hole + 1) & sizeMask;; i = (i + 1) & sizeMask) {
+      Entry *tmp = tptr + i;
+      std::unique_lock<Mutex> nl(tmp->lock, std::defer_lock);
+      counters.lock(nl);
+      std::size_t hash = tmp->hash.load(std::memory_order_relaxed);
+      if (hash == 0) {
+        break;
+      }
+      std::size_t home = hash & sizeMask;
+      if (((i - home) & sizeMask) < ((i - hole) & sizeMask)) {
+        // its home is after the hole, so it has to stay put
+        continue;
+      }
+      Entry *h = tptr + hole;
+      {
+        VersionGuard vg(h->version);
+        h->value.first = tmp->value.first;
+        h->value.second = std::move(tmp->value.second);
+        h->hash.store(hash, std::memory_order_relaxed);
+      }
+      hole = i;
+      holeLock = std::move(nl);
+    }
+    Entry *h = tptr + hole;
+    VersionGuard vg(h->version);
+    h->hash.store(0, std::memory_order_relaxed);
+  }
+};
+
+/// Pass as the Mutex of ConcurrentHashMapNoResize for the compact layout below
+struct SpinTagLock {};
+
+/**
+  Compact layout: instead of an Entry with its own mutex per slot, there is a
+  dense array of 64-bit tags that is probed on its own, and a separate array
+  of keys/values that is only touched once a tag matches. Each tag packs
+    bit 63: lock bit (spun on by writers)
+    bit 62: occupied
+    bits 32-61: version, bumped by every unlock (used by readIfFound)
+    bits 0-31: the low half of the hash
+  so a cache line of tags covers 8 slots. clear() keeps the versions.
+*/
+template <class K, class V, class Hash, class Eq>
+struct ConcurrentHashMapNoResize<K, V, Hash, Eq, SpinTagLock> {
+
+  typedef std::pair<K, V> value_type;
+
+  static const std::uint64_t lockbit = std::uint64_t(1) << 63;
+  static const std::uint64_t occupiedbit = std::uint64_t(1) << 62;
+  static const std::uint64_t versionone = std::uint64_t(1) << 32;
+  static const std::uint64_t versionmask =
+      (occupiedbit - 1) & ~(versionone - 1);
+  static const std::uint64_t hashbits = versionone - 1;
+
+  std::size_t size;
+  std::size_t sizeMask;
+  TableArray<std::atomic<std::uint64_t>> tags;
+  TableArray<value_type> values;
+  Hash hasher;
+  Eq eqer;
+  EraseSeq erasing;
+  mutable TableCounters counters;
+
+  /// A zero tag is an empty slot, so alloc is followed whenever K and V are
+  /// trivially copyable.
+  explicit ConcurrentHashMapNoResize(std::size_t sizeBits,
+                                     TableAlloc alloc = TableAlloc::eager)
+      : size(1 << sizeBits), sizeMask(size - 1),
+        tags(tableArray<std::atomic<std::uint64_t>>(size, zeroable(alloc))),
+        values(tableArray<value_type>(size, zeroable(alloc))), hasher{},
+        eqer{} {}
+
+  static TableAlloc zeroable(TableAlloc alloc) {
+    return std::is_trivially_copyable<K>::value &&
+                   std::is_trivially_copyable<V>::value
+               ? alloc
+               : TableAlloc::eager;
+  }
+
+  static bool occupied(std::uint64_t tag) { return tag & occupiedbit; }
+
+  /// spins until the lock bit is ours, returns the tag from before locking
+  static std::uint64_t lockTag(std::atomic<std::uint64_t> &tag,
+                               TableCounters &counters) {
+    for (std::size_t spins = 0;; spins++) {
+      std::uint64_t t = tag.load(std::memory_order_relaxed);
+      if (!(t & lockbit) &&
+          tag.compare_exchange_weak(t, t | lockbit, std::memory_order_acquire,
+                                    std::memory_order_relaxed)) {
+        return t;
+      }
+      if (!spins) {
+        counters.blocked();
+      }
+      if (spins >= 64) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  /// unlocks a tag that was locked when it read t, marking the value written
+  static void unlockTag(std::atomic<std::uint64_t> &tag, std::uint64_t t) {
+    tag.store((t & ~versionmask) | ((t + versionone) & versionmask),
+              std::memory_order_release);
+  }
+
+  /// run acquireClear after running this
+  void clear() {
+    for (std::size_t i = 0; i < size; i++) {
+      tags[i].store(tags[i].load(std::memory_order_relaxed) & versionmask,
+                    std::memory_order_relaxed);
+    }
+    counters.cleared();
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  /// run this in each thread after running clearNotThreadsafe
+  void acquireClear() { std::atomic_thread_fence(std::memory_order_acquire); }
+
+  /// see the primary template
+  template <class F> void forEach(F &&functor) {
+    for (std::size_t i = 0; i < size; i++) {
+      if (!occupied(tags[i].load(std::memory_order_relaxed))) {
+        continue;
+      }
+      std::uint64_t t = lockTag(tags[i], counters);
+      bool more = !occupied(t) ||
+                  functor(const_cast<const value_type &>(values[i]));
+      tags[i].store(t, std::memory_order_release);
+      if (!more) {
+        return;
+      }
+    }
+  }
+
+  template <class F>
+  decltype(std::declval<F>()(std::declval<V &>(), false))
+  findAndRun(const K &k, F &&functor) {
+    std::size_t kh = hasher(k);
+    std::uint64_t khb = kh & hashbits;
+    ProbeCount pc{counters, 0};
+    std::uint32_t es = erasing.read();
+    while (true) {
+      for (std::size_t i = kh & sizeMask;; i = (i + 1) & sizeMask) {
+        pc.n++;
+        std::atomic<std::uint64_t> &tag = tags[i];
+        std::uint64_t t = tag.load(std::memory_order_relaxed);
+        if (occupied(t) && (t & hashbits) != khb) {
+          continue;
+        }
+        t = lockTag(tag, counters);
+        if (!occupied(t)) {
+          if (!erasing.validate(es)) {
+            tag.store(t, std::memory_order_release);
+            break;
+          }
+          t = (t & versionmask) | occupiedbit | khb;
+          value_type &val = values[i];
+          val.first = k;
+          ::new (&val.second) V{};
+          TagUnlocker ul{tag, t};
+          counters.missed();
+          counters.inserted();
+          return functor(val.second, true);
+        }
+        if ((t & hashbits) == khb && eqer(k, values[i].first)) {
+          TagUnlocker ul{tag, t};
+          counters.hit();
+          return functor(values[i].second, false);
+        }
+        // Another thread has stolen this bucket for their own key
+        tag.store(t, std::memory_order_release);
+      }
+      es = erasing.settle();
+    }
+  }
+
+  template <class F>
+  decltype(std::declval<F>()(std::declval<V &>()))
+  runIfFound(const K &k, F &&functor,
+             const decltype(functor(std::declval<V &>())) &def) {
+    std::size_t kh = hasher(k);
+    std::uint64_t khb = kh & hashbits;
+    ProbeCount pc{counters, 0};
+    std::uint32_t es = erasing.read();
+    while (true) {
+      for (std::size_t i = kh & sizeMask;; i = (i + 1) & sizeMask) {
+        pc.n++;
+        std::atomic<std::uint64_t> &tag = tags[i];
+        std::uint64_t t = tag.load(std::memory_order_relaxed);
+        if (!occupied(t) && !(t & lockbit)) {
+          break;
+        }
+        if ((t & hashbits) != khb) {
+          continue;
+        }
+        t = lockTag(tag, counters);
+        if (occupied(t) && (t & hashbits) == khb &&
+            eqer(k, values[i].first)) {
+          TagUnlocker ul{tag, t};
+          counters.hit();
+          return functor(values[i].second);
+        }
+        tag.store(t, std::memory_order_release);
+        if (!occupied(t)) {
+          break;
+        }
+      }
+      if (erasing.validate(es)) {
+        counters.missed();
+        return def;
+      }
+      es = erasing.settle();
+    }
+  }
+
+  /// see the primary template
+  bool erase(const K &k) {
+    std::size_t kh = hasher(k);
+    std::uint64_t khb = kh & hashbits;
+    SeqLocker el(erasing.word, counters);
+    for (std::size_t i = kh & sizeMask;; i = (i + 1) & sizeMask) {
+      std::atomic<std::uint64_t> &tag = tags[i];
+      std::uint64_t t = tag.load(std::memory_order_relaxed);
+      if (!occupied(t) && !(t & lockbit)) {
+        return false;
+      }
+      if ((t & hashbits) != khb) {
+        continue;
+      }
+      t = lockTag(tag, counters);
+      if (occupied(t) && (t & hashbits) == khb && eqer(k, values[i].first)) {
+        el.written = true;
+        counters.erased();
+        shiftBack(i, t);
+        return true;
+      }
+      tag.store(t, std::memory_order_release);
+      if (!occupied(t)) {
+        return false;
+      }
+    }
+  }
+
+  /// pulls k's home tag and value into cache ahead of a lookup
+  void prefetch(const K &k) const {
+    std::size_t i = hasher(k) & sizeMask;
+    __builtin_prefetch(&tags[i], 1);
+    __builtin_prefetch(&values[i], 1);
+  }
+
+  /// slots looked at to find k or rule it out. Not threadsafe.
+  std::size_t probeLength(const K &k) const {
+    std::size_t kh = hasher(k);
+    std::uint64_t khb = kh & hashbits;
+    std::size_t toreturn = 1;
+    for (std::size_t i = kh & sizeMask;; i = (i + 1) & sizeMask) {
+      std::uint64_t t = tags[i].load(std::memory_order_relaxed);
+      if (!occupied(t) || toreturn > sizeMask ||
+          ((t & hashbits) == khb && eqer(k, values[i].first))) {
+        return toreturn;
+      }
+      toreturn++;
+    }
+  }
+
+  /// see the primary template
+  template <class F>
+  decltype(std::declval<F>()(std::declval<V &>()))
+  readIfFound(const K &k, F &&functor,
+              const decltype(functor(std::declval<V &>())) &def) const {
+    static_assert(std::is_trivially_copyable<K>::value &&
+                      std::is_trivially_copyable<V>::value,
+                  "readIfFound copies entries bytewise");
+    std::size_t kh = hasher(k);
+    std::uint64_t khb = kh & hashbits;
+    ProbeCount pc{counters, 0};
+    std::uint32_t es = erasing.read();
+    while (true) {
+      for (std::size_t i = kh & sizeMask;; i = (i + 1) & sizeMask) {
+        pc.n++;
+        const std::atomic<std::uint64_t> &tag = tags[i];
+        typename std::aligned_storage<sizeof(value_type),
+                                      alignof(value_type)>::type snap;
+        std::uint64_t t;
+        for (std::size_t spins = 0;; spins++) {
+          t = tag.load(std::memory_order_acquire);
+          bool mine = !occupied(t) || (t & hashbits) == khb;
+          if (!(t & lockbit) && mine) {
+            if (!occupied(t)) {
+              break;
+            }
+            std::memcpy(&snap, &values[i], sizeof(value_type));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (tag.load(std::memory_order_relaxed) == t) {
+              break;
+            }
+          } else if (!mine) {
+            // some other key's, which a lock holder cannot change into k
+            break;
+          }
+          readBackoff(spins);
+        }
+        if (!occupied(t)) {
+          break;
+        }
+        if ((t & hashbits) != khb) {
+          continue;
+        }
+        value_type &val = *reinterpret_cast<value_type *>(&snap);
+        if (eqer(k, val.first)) {
+          counters.hit();
+          return functor(val.second);
+        }
+      }
+      if (erasing.validate(es)) {
+        counters.missed();
+        return def;
+      }
+      es = erasing.settle();
+    }
+  }
+
+  /// see the primary template
+  TableStats stats() const { return counters.snapshot(size); }
+
+private:
+  struct TagUnlocker {
+    std::atomic<std::uint64_t> &tag;
+    std::uint64_t t;
+
+    ~TagUnlocker() { unlockTag(tag, t); }
+  };
+
+  /// see the primary template, t is the hole's tag from before locking it
+  void shiftBack(std::size_t hole, std::uint64_t t) {
+    for (std::size_t i = (hole + 1) & sizeMask;; i = (i + 1) & sizeMask) {
+      std::uint64_t nt = lockTag(tags[i], counters);
+      if (!occupied(nt)) {
+        tags[i].store(nt, std::memory_order_release);
+        break;
+      }
+      std::size_t home = (nt & hashbits) & sizeMask;
+      if (((i - home) & sizeMask) < ((i - hole) & sizeMask)) {
+        tags[i].store(nt, std::memory_order_release);
+        continue;
+      }
+      values[hole].first = values[i].first;
+      values[hole].second = std::move(values[i].second);
+      unlockTag(tags[hole], (t & ~hashbits) | (nt & hashbits));
+      hole = i;
+      t = nt;
+    }
+    unlockTag(tags[hole], t & versionmask);
+  }
+};
+
+/// bit i is set where ctrl[i] == c, for the 16 control bytes of a group
+inline std::uint32_t matchCtrl(const std::uint8_t *ctrl, std::uint8_t c) {
+#ifdef __SSE2__
+  __m128i cs = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ctrl));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(cs, _mm_set1_epi8(c)));
+#else
+  std::uint32_t toreturn = 0;
+  for (std::size_t i = 16; i--;) {
+    toreturn |= std::uint32_t(ctrl[i] == c) << i;
+  }
+  return toreturn;
+#endif
+}
+
+/// Pass as the Mutex of ConcurrentHashMapNoResize for the grouped layout below
+struct GroupTagLock {};
+
+/**
+  Grouped layout, after Swiss tables: slots come in groups of 16, and each
+  group keeps 16 one-byte control bytes (emptyctrl = 0, or the top 7 bits of
+  the mixed hash with the high bit set) next to its lock word, all in half a
+  cache line. A probe matches
+  a whole group of control bytes at once (a single SSE2 compare when
+  available), and only reads keys whose control byte matched. The hash is
+  multiplied through first, so all 64 bits of it pick the group and the
+  control byte. Locking is per group: the lock word's low bit is the lock, and
+  every unlock after a write bumps the rest, which readIfFound validates on.
+*/
+template <class K, class V, class Hash, class Eq>
+struct ConcurrentHashMapNoResize<K, V, Hash, Eq, GroupTagLock> {
+
+  typedef std::pair<K, V> value_type;
+
+  static const std::size_t groupSize = 16;
+  static const std::uint8_t emptyctrl = 0;
+
+  struct alignas(32) Group {
+    std::uint8_t ctrl[groupSize];
+    std::atomic<std::uint32_t> seq;
+  };
+
+  std::size_t size;
+  std::size_t groupBits;
+  std::size_t groupMask;
+  std::unique_ptr<Group[], MaybeMapped<AlignedDeleter>> groups;
+  TableArray<value_type> values;
+  Hash hasher;
+  Eq eqer;
+  EraseSeq erasing;
+  mutable TableCounters counters;
+
+  /// An all-zero group is empty and unlocked, so alloc is followed whenever
+  /// K and V are trivially copyable.
+  explicit ConcurrentHashMapNoResize(std::size_t sizeBits,
+                                     TableAlloc alloc = TableAlloc::eager)
+      : size(std::size_t(1) << (sizeBits < 4 ? 4 : sizeBits)),
+        groupBits(sizeBits < 4 ? 0 : sizeBits - 4),
+        groupMask(size / groupSize - 1),
+        groups(allocGroups(size / groupSize, zeroable(alloc))),
+        values(tableArray<value_type>(size, zeroable(alloc))), hasher{},
+        eqer{} {}
+
+  static TableAlloc zeroable(TableAlloc alloc) {
+    return std::is_trivially_copyable<K>::value &&
+                   std::is_trivially_copyable<V>::value
+               ? alloc
+               : TableAlloc::eager;
+  }
+
+  static std::unique_ptr<Group[], MaybeMapped<AlignedDeleter>>
+  allocGroups(std::size_t numGroups, TableAlloc alloc) {
+    if (alloc != TableAlloc::eager) {
+      return mappedArray<Group, AlignedDeleter>(numGroups, alloc);
+    }
+    Group *toreturn = alignedArray<Group>(numGroups);
+    for (std::size_t i = numGroups; i--;) {
+      std::memset(toreturn[i].ctrl, emptyctrl, groupSize);
+      toreturn[i].seq.store(0, std::memory_order_relaxed);
+    }
+    return {toreturn, MaybeMapped<AlignedDeleter>{0}};
+  }
+
+  std::uint64_t mixedHash(const K &k) const {
+    return std::uint64_t(hasher(k)) * 0x9e3779b97f4a7c15ULL;
+  }
+  static std::uint8_t ctrlOf(std::uint64_t mh) { return 0x80 | mh >> 57; }
+  std::size_t homeGroup(std::uint64_t mh) const {
+    return (mh >> (57 - groupBits)) & groupMask;
+  }
+
+  /// run acquireClear after running this
+  void clear() {
+    for (std::size_t i = groupMask + 1; i--;) {
+      std::memset(groups[i].ctrl, emptyctrl, groupSize);
+    }
+    counters.cleared();
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  /// run this in each thread after running clearNotThreadsafe
+  void acquireClear() { std::atomic_thread_fence(std::memory_order_acquire); }
+
+  /// see the primary template, a group at a time
+  template <class F> void forEach(F &&functor) {
+    for (std::size_t gi = 0; gi <= groupMask; gi++) {
+      Group &g = groups[gi];
+      std::uint32_t seq = SeqLocker::lock(g.seq, counters);
+      const value_type *gvals = values.get() + gi * groupSize;
+      bool more = true;
+      for (std::uint32_t m = ~matchCtrl(g.ctrl, emptyctrl) & 0xffff; m && more;
+           m &= m - 1) {
+        more = functor(gvals[__builtin_ctz(m)]);
+      }
+      g.seq.store(seq, std::memory_order_release);
+      if (!more) {
+        return;
+      }
+    }
+  }
+
+  template <class F>
+  decltype(std::declval<F>()(std::declval<V &>(), false))
+  findAndRun(const K &k, F &&functor) {
+    std::uint64_t mh = mixedHash(k);
+    std::uint8_t c = ctrlOf(mh);
+    ProbeCount pc{counters, 0};
+    std::uint32_t es = erasing.read();
+    while (true) {
+      for (std::size_t gi = homeGroup(mh);; gi = (gi + 1) & groupMask) {
+        pc.n++;
+        Group &g = groups[gi];
+        SeqLocker gl(g.seq, counters);
+        value_type *gvals = values.get() + gi * groupSize;
+        for (std::uint32_t m = matchCtrl(g.ctrl, c); m; m &= m - 1) {
+          value_type &val = gvals[__builtin_ctz(m)];
+          if (eqer(k, val.first)) {
+            WriteDetector<V> wd(gl.written, val.second);
+            counters.hit();
+            return functor(val.second, false);
+          }
+        }
+        std::uint32_t empties = matchCtrl(g.ctrl, emptyctrl);
+        if (empties) {
+          if (!erasing.validate(es)) {
+            break;
+          }
+          std::size_t slot = __builtin_ctz(empties);
+          value_type &val = gvals[slot];
+          val.first = k;
+          ::new (&val.second) V{};
+          g.ctrl[slot] = c;
+          gl.written = true;
+          counters.missed();
+          counters.inserted();
+          return functor(val.second, true);
+        }
+      }
+      es = erasing.settle();
+    }
+  }
+
+  template <class F>
+  decltype(std::declval<F>()(std::declval<V &>()))
+  runIfFound(const K &k, F &&functor,
+             const decltype(functor(std::declval<V &>())) &def) {
+    std::uint64_t mh = mixedHash(k);
+    std::uint8_t c = ctrlOf(mh);
+    ProbeCount pc{counters, 0};
+    std::uint32_t es = erasing.read();
+    while (true) {
+      for (std::size_t gi = homeGroup(mh);; gi = (gi + 1) & groupMask) {
+        pc.n++;
+        Group &g = groups[gi];
+        SeqLocker gl(g.seq, counters);
+        value_type *gvals = values.get() + gi * groupSize;
+        for (std::uint32_t m = matchCtrl(g.ctrl, c); m; m &= m - 1) {
+          value_type &val = gvals[__builtin_ctz(m)];
+          if (eqer(k, val.first)) {
+            WriteDetector<V> wd(gl.written, val.second);
+            counters.hit();
+            return functor(val.second);
+          }
+        }
+        if (matchCtrl(g.ctrl, emptyctrl)) {
+          break;
+        }
+      }
+      if (erasing.validate(es)) {
+        counters.missed();
+        return def;
+      }
+      es = erasing.settle();
+    }
+  }
+
+  /// See the primary template. Entries shift back a group at a time: any
+  /// entry of a later group whose probe passes the hole's group can fill it.
+  bool erase(const K &k) {
+    std::uint64_t mh = mixedHash(k);
+    std::uint8_t c = ctrlOf(mh);
+    SeqLocker el(erasing.word, counters);
+    for (std::size_t gi = homeGroup(mh);; gi = (gi + 1) & groupMask) {
+      Group &g = groups[gi];
+      std::uint32_t seq = SeqLocker::lock(g.seq, counters);
+      value_type *gvals = values.get() + gi * groupSize;
+      for (std::uint32_t m = matchCtrl(g.ctrl, c); m; m &= m - 1) {
+        if (eqer(k, gvals[__builtin_ctz(m)].first)) {
+          el.written = true;
+          counters.erased();
+          shiftBack(gi, seq, __builtin_ctz(m));
+          return true;
+        }
+      }
+      g.seq.store(seq, std::memory_order_release);
+      if (matchCtrl(g.ctrl, emptyctrl)) {
+        return false;
+      }
+    }
+  }
+
+  /// pulls k's home group and the start of its values into cache ahead of a
+  /// lookup
+  void prefetch(const K &k) const {
+    std::size_t gi = homeGroup(mixedHash(k));
+    __builtin_prefetch(&groups[gi], 1);
+    __builtin_prefetch(values.get() + gi * groupSize, 1);
+  }
+
+  /// groups looked at to find k or rule it out. Not threadsafe.
+  std::size_t probeLength(const K &k) const {
+    std::uint64_t mh = mixedHash(k);
+    std::uint8_t c = ctrlOf(mh);
+    std::size_t toreturn = 1;
+    for (std::size_t gi = homeGroup(mh);; gi = (gi + 1) & groupMask) {
+      const value_type *gvals = values.get() + gi * groupSize;
+      for (std::uint32_t m = matchCtrl(groups[gi].ctrl, c); m; m &= m - 1) {
+        if (eqer(k, gvals[__builtin_ctz(m)].first)) {
+          return toreturn;
+        }
+      }
+      if (matchCtrl(groups[gi].ctrl, emptyctrl) || toreturn > groupMask) {
+        return toreturn;
+      }
+      toreturn++;
+    }
+  }
+
+  /// see the primary template, a group that is being written is read again
+  /// once the write is done
+  template <class F>
+  decltype(std::declval<F>()(std::declval<V &>()))
+  readIfFound(const K &k, F &&functor,
+              const decltype(functor(std::declval<V &>())) &def) const {
+    static_assert(std::is_trivially_copyable<K>::value &&
+                      std::is_trivially_copyable<V>::value,
+                  "readIfFound copies entries bytewise");
+    std::uint64_t mh = mixedHash(k);
+    std::uint8_t c = ctrlOf(mh);
+    typename std::aligned_storage<sizeof(value_type),
+                                  alignof(value_type)>::type snap;
+    value_type &val = *reinterpret_cast<value_type *>(&snap);
+    ProbeCount pc{counters, 0};
+    std::uint32_t es = erasing.read();
+    while (true) {
+      for (std::size_t gi = homeGroup(mh);; gi = (gi + 1) & groupMask) {
+        pc.n++;
+        const Group &g = groups[gi];
+        const value_type *gvals = values.get() + gi * groupSize;
+        bool found, stable, hasEmpty;
+        std::size_t spins = 0;
+        do {
+          std::uint32_t seq = g.seq.load(std::memory_order_acquire);
+          if (seq & 1) {
+            readBackoff(spins++);
+            stable = false;
+            continue;
+          }
+          std::uint8_t ctrl[groupSize];
+          std::memcpy(ctrl, g.ctrl, groupSize);
+          found = false;
+          for (std::uint32_t m = matchCtrl(ctrl, c); m && !found;
+               m &= m - 1) {
+            std::memcpy(&snap, gvals + __builtin_ctz(m), sizeof(value_type));
+            found = eqer(k, val.first);
+          }
+          hasEmpty = matchCtrl(ctrl, emptyctrl);
+          std::atomic_thread_fence(std::memory_order_acquire);
+          stable = g.seq.load(std::memory_order_relaxed) == seq;
+          if (!stable) {
+            readBackoff(spins++);
+          }
+        } while (!stable);
+        if (found) {
+          counters.hit();
+          return functor(val.second);
+        }
+        if (hasEmpty) {
+          break;
+        }
+      }
+      if (erasing.validate(es)) {
+        counters.missed();
+        return def;
+      }
+      es = erasing.settle();
+    }
+  }
+
+  /// see the primary template
+  TableStats stats() const { return counters.snapshot(size); }
+
+private:
+  /**
+    Empties slot of group hole, which is locked from seq. While the hole's
+    group was full, later groups up to the next one that had an empty slot
+    may hold entries whose probe passes it, and the first one found moves
+    into the hole, leaving a new hole behind. Holds the hole's group and the
+    one being searched, in probe order.
+  */
+  void shiftBack(std::size_t hole, std::uint32_t seq, std::size_t slot) {
+    bool wasFull = !matchCtrl(groups[hole].ctrl, emptyctrl);
+    groups[hole].ctrl[slot] = emptyctrl;
+    for (std::size_t gi = (hole + 1) & groupMask; wasFull;
+         gi = (gi + 1) & groupMask) {
+      Group &g = groups[gi];
+      std::uint32_t gseq = SeqLocker::lock(g.seq, counters);
+      value_type *gvals = values.get() + gi * groupSize;
+      std::uint32_t occupied = ~matchCtrl(g.ctrl, emptyctrl) & 0xffff;
+      bool hadEmpty = occupied != 0xffff;
+      std::size_t from = groupSize;
+      for (std::uint32_t m = occupied; m && from == groupSize; m &= m - 1) {
+        std::size_t home = homeGroup(mixedHash(gvals[__builtin_ctz(m)].first));
+        if (((gi - home) & groupMask) >= ((gi - hole) & groupMask)) {
+          from = __builtin_ctz(m);
+        }
+      }
+      if (from == groupSize) {
+        g.seq.store(gseq, std::memory_order_release);
+        wasFull = !hadEmpty;
+        continue;
+      }
+      value_type &val = values[hole * groupSize + slot];
+      val.first = gvals[from].first;
+      val.second = std::move(gvals[from].second);
+      groups[hole].ctrl[slot] = g.ctrl[from];
+      g.ctrl[from] = emptyctrl;
+      groups[hole].seq.store(seq + 2, std::memory_order_release);
+      hole = gi;
+      seq = gseq;
+      slot = from;
+      wasFull = !hadEmpty;
+    }
+    groups[hole].seq.store(seq + 2, std::memory_order_release);
+  }
+};
+
+/// Shared body of the findAndRunBatch members: prefetches every key's bucket
+/// first, then runs map.findAndRun on each with functor(i, value, isNew)
+template <class Map, class K, class F>
+void batchFindAndRun(Map &map, const K *ks, std::size_t n, F &functor) {
+  for (std::size_t i = 0; i < n; i++) {
+    map.prefetch(ks[i]);
+  }
+  for (std::size_t i = 0; i < n; i++) {
+    map.findAndRun(ks[i], [&functor, i](typename Map::mapped_type &val,
+                                        bool isNew) -> void {
+      functor(i, val, isNew);
+    });
+  }
+}
+
+/// Shared body of the runIfFoundBatch members, see batchFindAndRun. functor
+/// gets (i, value) for the keys that were found.
+template <class Map, class K, class F>
+void batchRunIfFound(Map &map, const K *ks, std::size_t n, F &functor) {
+  for (std::size_t i = 0; i < n; i++) {
+    map.prefetch(ks[i]);
+  }
+  for (std::size_t i = 0; i < n; i++) {
+    map.runIfFound(ks[i],
+                   [&functor, i](typename Map::mapped_type &val) -> bool {
+                     functor(i, val);
+                     return true;
+                   },
+                   false);
+  }
+}
+
+/// batchRunIfFound through map.readIfFound, so functor gets copies
+template <class Map, class K, class F>
+void batchReadIfFound(Map &map, const K *ks, std::size_t n, F &functor) {
+  for (std::size_t i = 0; i < n; i++) {
+    map.prefetch(ks[i]);
+  }
+  for (std::size_t i = 0; i < n; i++) {
+    map.readIfFound(ks[i],
+                    [&functor, i](typename Map::mapped_type &val) -> bool {
+                      functor(i, val);
+                      return true;
+                    },
+                    false);
+  }
+}
+
+/**
+  Growable counterpart of ConcurrentHashMapNoResize. Once a table is 3/4 full,
+  a table of twice the size is chained behind it, and every operation that
+  touches the old table first moves `migrateChunk` buckets over to the new one.
+  That spreads the migration over many calls instead of stalling one of them.
+  V has to be move assignable, as migrating moves values between tables. Old
+  tables are only freed by clear() and the destructor, as other threads may
+  still be probing them until then.
+
+  Every hash word carries the epoch it was written in (upper 32 bits), and
+  words from an older epoch read as empty. clear() just bumps the epoch, so
+  resetting a per-frame table does not depend on its capacity.
+*/
+template <class K, class V, class Hash, class Eq, class Mutex = std::mutex>
+class ConcurrentHashMap {
+
+public:
+  typedef std::pair<K, V> value_type;
+  typedef V mapped_type;
+
+  static const std::size_t hashmask = std::size_t(1) << 31;
+  /// marks a bucket whose contents now live in the next table
+  static const std::size_t movedmask = std::size_t(1) << 30;
+  static const std::size_t statemask = (std::size_t(1) << 32) - 1;
+  static const std::size_t migrateChunk = 16;
+
+  struct Entry {
+    Mutex lock;       /// Applies to r/w on value, just w on hash
+    value_type value; /// hash = (real hash) | hashmask, and unoccupied is 0
+    /// moved entries keep their hash (| movedmask), moved empty ones are just
+    /// movedmask, so probe chains stay intact while migrating. All of that
+    /// is in the low 32 bits, the epoch is above.
+    std::atomic<std::uint64_t> hash;
+
+    Entry() : lock{}, value{}, hash{0} {}
+  };
+
+private:
+  struct Table {
+    std::size_t sizeBits;
+    std::size_t size;
+    std::size_t sizeMask;
+    std::unique_ptr<Entry[]> entries;
+    std::atomic<std::size_t> count;
+    std::atomic<Table *> next;
+    std::atomic<std::size_t> migrateCursor;
+    std::atomic<std::size_t> migrated;
+    Table *retiredNext;
+
+    explicit Table(std::size_t sizeBits)
+        : sizeBits(sizeBits), size(std::size_t(1) << sizeBits),
+          sizeMask(size - 1), entries(new Entry[size]), count{0}, next{nullptr},
+          migrateCursor{0}, migrated{0}, retiredNext(nullptr) {}
+
+    bool overloaded() const {
+      return count.load(std::memory_order_relaxed) >= size - (size >> 2);
+    }
+  };
+
+  std::atomic<Table *> curr;
+  std::atomic<Table *> retired;
+  /// current epoch << 32, never 0 so that fresh tables read as empty
+  std::atomic<std::uint64_t> epochBits;
+  Hash hasher;
+  Eq eqer;
+  mutable TableCounters counters;
+
+  /// the low half of a hash word, or 0 if it was written in an older epoch
+  static std::size_t stateOf(std::uint64_t word, std::uint64_t ebits) {
+    return (word & ~std::uint64_t(statemask)) == ebits ? word & statemask : 0;
+  }
+
+  std::uint64_t loadEpochBits() const {
+    return epochBits.load(std::memory_order_relaxed);
+  }
+
+  void retire(Table *t) {
+    Table *head = retired.load(std::memory_order_relaxed);
+    do {
+      t->retiredNext = head;
+    } while (!retired.compare_exchange_weak(head, t, std::memory_order_release,
+                                            std::memory_order_relaxed));
+  }
+
+  void freeRetired() {
+    Table *t = retired.exchange(nullptr, std::memory_order_acquire);
+    while (t) {
+      Table *n = t->retiredNext;
+      delete t;
+      t = n;
+    }
+  }
+
+  /// Counts a new key into t, whose entries prev is still migrating into if
+  /// it is not null, unless that could leave too few empty buckets for the
+  /// rest of prev. Returns whether it did. Without this, inserts could fill
+  /// t while a migrating thread is descheduled, and t cannot grow before it
+  /// is current, which takes that thread finding an empty bucket in t.
+  static bool reserve(Table *t, const Table *prev) {
+    // migrated first, so the count below has every move it accounts for
+    std::size_t left =
+        prev ? prev->size - prev->migrated.load(std::memory_order_acquire)
+             : 0;
+    std::size_t c = t->count.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (!prev || c + left < t->size) {
+      return true;
+    }
+    t->count.fetch_sub(1, std::memory_order_relaxed);
+    return false;
+  }
 
-  typedef std::pair<K, V> value_type;
+  /// only the current table may start growing, so at most two are live
+  void maybeGrow(Table *t) {
+    if (!t->overloaded() || t->next.load(std::memory_order_relaxed) ||
+        curr.load(std::memory_order_relaxed) != t) {
+      return;
+    }
+    Table *n = new Table(t->sizeBits + 1);
+    Table *expected = nullptr;
+    if (!t->next.compare_exchange_strong(expected, n,
+                                         std::memory_order_release,
+                                         std::memory_order_relaxed)) {
+      delete n;
+    }
+  }
 
-  static const std::size_t hashmask = std::size_t(1) << 31;
+  /// caller holds the lock of the source bucket, so lock order is old -> new
+  void moveInto(Table *n, std::size_t khm, value_type &value,
+                std::uint64_t ebits) {
+    Entry *tptr = n->entries.get();
+    for (std::size_t i = khm & n->sizeMask;; i = (i + 1) & n->sizeMask) {
+      Entry *tmp = tptr + i;
+      if (stateOf(tmp->hash.load(std::memory_order_relaxed), ebits) != 0) {
+        continue;
+      }
+      std::unique_lock<Mutex> ll(tmp->lock, std::defer_lock);
+      counters.lock(ll);
+      if (stateOf(tmp->hash.load(std::memory_order_relaxed), ebits) == 0) {
+        tmp->value.first = value.first;
+        tmp->value.second = std::move(value.second);
+        tmp->hash.store(ebits | khm, std::memory_order_release);
+        n->count.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+    }
+  }
 
-  struct Entry {
-    Mutex lock;       /// Applies to r/w on value, just w on hash
-    value_type value; /// hash = (real hash) | hashmask, and unoccupied is 0
-    std::atomic<std::size_t> hash;
+  void helpMigrate(Table *t) {
+    Table *n = t->next.load(std::memory_order_acquire);
+    if (!n) {
+      return;
+    }
+    std::size_t beg =
+        t->migrateCursor.fetch_add(migrateChunk, std::memory_order_relaxed);
+    if (beg >= t->size) {
+      return;
+    }
+    std::size_t end =
+        beg + migrateChunk < t->size ? beg + migrateChunk : t->size;
+    std::uint64_t ebits = loadEpochBits();
+    for (std::size_t i = beg; i < end; i++) {
+      Entry *tmp = t->entries.get() + i;
+      std::unique_lock<Mutex> ll(tmp->lock, std::defer_lock);
+      counters.lock(ll);
+      std::size_t hash =
+          stateOf(tmp->hash.load(std::memory_order_relaxed), ebits);
+      if (hash) {
+        moveInto(n, hash, tmp->value, ebits);
+      }
+      tmp->hash.store(ebits | hash | movedmask, std::memory_order_release);
+    }
+    if (t->migrated.fetch_add(end - beg, std::memory_order_acq_rel) +
+            (end - beg) ==
+        t->size) {
+      Table *expected = t;
+      if (curr.compare_exchange_strong(expected, n, std::memory_order_release,
+                                       std::memory_order_relaxed)) {
+        retire(t);
+      }
+    }
+  }
 
-    Entry() : lock{}, value{}, hash{0} {}
-  };
+  Table *enter() {
+    Table *t = curr.load(std::memory_order_acquire);
+    maybeGrow(t);
+    helpMigrate(t);
+    return t;
+  }
 
-  std::size_t size;
-  std::size_t sizeMask;
-  std::unique_ptr<Entry[]> table;
-  Hash hasher;
-  Eq eqer;
+public:
+  explicit ConcurrentHashMap(std::size_t sizeBits)
+      : curr{new Table(sizeBits)}, retired{nullptr},
+        epochBits{std::uint64_t(1) << 32}, hasher{}, eqer{} {}
 
-  explicit ConcurrentHashMapNoResize(std::size_t sizeBits)
-      : size(1 << sizeBits), sizeMask(size - 1),
-        table(new Entry[size]), hasher{}, eqer{} {}
+  ConcurrentHashMap(const ConcurrentHashMap &) = delete;
+  ConcurrentHashMap &operator=(const ConcurrentHashMap &) = delete;
 
-  /// run acquireClear after running this
+  ~ConcurrentHashMap() {
+    freeRetired();
+    Table *t = curr.load(std::memory_order_relaxed);
+    while (t) {
+      Table *n = t->next.load(std::memory_order_relaxed);
+      delete t;
+      t = n;
+    }
+  }
+
+  /// number of buckets in the newest table
+  std::size_t capacity() const {
+    const Table *t = curr.load(std::memory_order_relaxed);
+    const Table *n;
+    while ((n = t->next.load(std::memory_order_relaxed))) {
+      t = n;
+    }
+    return t->size;
+  }
+
+  /// Not threadsafe: run acquireClear after running this. Keeps the grown
+  /// size, and frees every table that has been migrated away from. Only
+  /// walks the table when the 32-bit epoch wraps around.
   void clear() {
-    for (std::size_t i = 0; i < size; i++) {
-      table[i].hash.store(0, std::memory_order_relaxed);
+    Table *t = curr.load(std::memory_order_relaxed);
+    while (Table *n = t->next.load(std::memory_order_relaxed)) {
+      retire(t);
+      t = n;
+    }
+    freeRetired();
+    std::uint64_t ebits = loadEpochBits() + (std::uint64_t(1) << 32);
+    if (!ebits) {
+      for (std::size_t i = 0; i < t->size; i++) {
+        t->entries[i].hash.store(0, std::memory_order_relaxed);
+      }
+      ebits = std::uint64_t(1) << 32;
     }
+    epochBits.store(ebits, std::memory_order_relaxed);
+    t->count.store(0, std::memory_order_relaxed);
+    t->migrateCursor.store(0, std::memory_order_relaxed);
+    t->migrated.store(0, std::memory_order_relaxed);
+    curr.store(t, std::memory_order_relaxed);
+    counters.cleared();
     std::atomic_thread_fence(std::memory_order_release);
   }
 
-  /// run this in each thread after running clearNotThreadsafe
+  /// run this in each thread after running clear
   void acquireClear() { std::atomic_thread_fence(std::memory_order_acquire); }
 
   template <class F>
   decltype(std::declval<F>()(std::declval<V &>(), false))
   findAndRun(const K &k, F &&functor) {
-    std::size_t kh = hasher(k);
-    std::size_t khm = kh | hashmask;
-    Entry *tptr = table.get();
-    for (std::size_t i = kh & sizeMask;; i = (i + 1) & sizeMask) {
-      Entry *tmp = tptr + i;
-      std::size_t hash = tmp->hash.load(std::memory_order_relaxed);
-      if (hash == 0) {
-        std::unique_lock<Mutex> ll(tmp->lock);
-        hash = tmp->hash.load(std::memory_order_relaxed);
-        if ((hash != 0) && (hash != khm)) {
-          // Another thread has stolen this bucket for their own key
-          continue;
-        } else if (hash == 0) {
-          tmp->hash.store(khm, std::memory_order_relaxed);
-          tmp->value.first = k;
-          ::new (&tmp->value.second) V{};
-          return functor(tmp->value.second, true);
+    std::size_t khm = ((hasher(k) & statemask) | hashmask) & ~movedmask;
+    std::size_t khmm = khm | movedmask;
+    std::uint64_t ebits = loadEpochBits();
+    Table *t = enter();
+    Table *prev = nullptr;
+    ProbeCount pc{counters, 0};
+    while (true) {
+      Entry *tptr = t->entries.get();
+      std::size_t i = khm & t->sizeMask;
+      bool full = false;
+      for (std::size_t probes = 0;; i = (i + 1) & t->sizeMask) {
+        if (probes++ == t->size) {
+          // wrapped around a full table, so the key can only be further on
+          maybeGrow(t);
+          if (t->next.load(std::memory_order_relaxed)) {
+            break;
+          }
+          probes = 0;
         }
-        return functor(tmp->value.second, false);
-      }
-      if (hash == khm) {
-        std::unique_lock<Mutex> ll(tmp->lock);
-        if (eqer(k, tmp->value.first)) {
-          return functor(tmp->value.second, false);
+        pc.n++;
+        Entry *tmp = tptr + i;
+        std::size_t hash =
+            stateOf(tmp->hash.load(std::memory_order_acquire), ebits);
+        if (hash == 0) {
+          std::unique_lock<Mutex> ll(tmp->lock, std::defer_lock);
+          counters.lock(ll);
+          hash = stateOf(tmp->hash.load(std::memory_order_relaxed), ebits);
+          if (hash == 0 && !reserve(t, prev)) {
+            full = true;
+            break;
+          }
+          if (hash == 0) {
+            tmp->value.first = k;
+            ::new (&tmp->value.second) V{};
+            tmp->hash.store(ebits | khm, std::memory_order_relaxed);
+            counters.missed();
+            counters.inserted();
+            return functor(tmp->value.second, true);
+          }
+          if (hash == khm && eqer(k, tmp->value.first)) {
+            counters.hit();
+            return functor(tmp->value.second, false);
+          }
+        } else if (hash == khm) {
+          std::unique_lock<Mutex> ll(tmp->lock, std::defer_lock);
+          counters.lock(ll);
+          hash = stateOf(tmp->hash.load(std::memory_order_relaxed), ebits);
+          if (hash == khm && eqer(k, tmp->value.first)) {
+            counters.hit();
+            return functor(tmp->value.second, false);
+          }
         }
+        if (hash == movedmask ||
+            (hash == khmm && eqer(k, tmp->value.first))) {
+          break;
+        }
+      }
+      if (full) {
+        // wait for prev to finish migrating, then start over from the table
+        // that replaced it, which may grow by then
+        helpMigrate(prev);
+        std::this_thread::yield();
+        t = enter();
+        prev = nullptr;
+        continue;
       }
+      prev = t;
+      t = t->next.load(std::memory_order_acquire);
+      helpMigrate(t);
     }
   }
 
@@ -97,23 +1767,92 @@ struct ConcurrentHashMapNoResize {
   decltype(std::declval<F>()(std::declval<V &>()))
   runIfFound(const K &k, F &&functor,
              const decltype(functor(std::declval<V &>())) &def) {
-    std::size_t kh = hasher(k);
-    std::size_t khm = kh | hashmask;
-    Entry *tptr = table.get();
-    for (std::size_t i = kh & sizeMask;; i = (i + 1) & sizeMask) {
-      Entry *tmp = tptr + i;
-      std::size_t hash = tmp->hash.load(std::memory_order_relaxed);
-      if (hash == 0) {
-        return def;
+    std::size_t khm = ((hasher(k) & statemask) | hashmask) & ~movedmask;
+    std::size_t khmm = khm | movedmask;
+    std::uint64_t ebits = loadEpochBits();
+    Table *t = enter();
+    ProbeCount pc{counters, 0};
+    while (true) {
+      Entry *tptr = t->entries.get();
+      std::size_t i = khm & t->sizeMask;
+      for (std::size_t probes = 0;; i = (i + 1) & t->sizeMask) {
+        if (probes++ == t->size) {
+          if (t->next.load(std::memory_order_relaxed)) {
+            break;
+          }
+          counters.missed();
+          return def;
+        }
+        pc.n++;
+        Entry *tmp = tptr + i;
+        std::size_t hash =
+            stateOf(tmp->hash.load(std::memory_order_acquire), ebits);
+        if (hash == 0) {
+          counters.missed();
+          return def;
+        }
+        if (hash == khm) {
+          std::unique_lock<Mutex> ll(tmp->lock, std::defer_lock);
+          counters.lock(ll);
+          hash = stateOf(tmp->hash.load(std::memory_order_relaxed), ebits);
+          if (hash == khm && eqer(k, tmp->value.first)) {
+            counters.hit();
+            return functor(tmp->value.second);
+          }
+        }
+        if (hash == movedmask ||
+            (hash == khmm && eqer(k, tmp->value.first))) {
+          break;
+        }
       }
-      if (hash == khm) {
-        std::unique_lock<Mutex> ll(tmp->lock);
-        if (eqer(k, tmp->value.first)) {
-          return functor(tmp->value.second);
+      t = t->next.load(std::memory_order_acquire);
+      helpMigrate(t);
+    }
+  }
+
+  /// pulls k's home bucket in the current table into cache ahead of a lookup
+  void prefetch(const K &k) const {
+    const Table *t = curr.load(std::memory_order_relaxed);
+    const Entry &e = t->entries[hasher(k) & t->sizeMask];
+    __builtin_prefetch(&e, 1);
+    __builtin_prefetch(&e.hash, 1);
+  }
+
+  /// findAndRun on ks[0..n), calling functor(i, value, isNew) for each. All
+  /// home buckets are prefetched before the first key is resolved, so their
+  /// cache misses overlap instead of queueing. Meant for a handful of keys.
+  template <class F>
+  void findAndRunBatch(const K *ks, std::size_t n, F &&functor) {
+    batchFindAndRun(*this, ks, n, functor);
+  }
+
+  /// runIfFound on ks[0..n), calling functor(i, value) for the ones found,
+  /// prefetching like findAndRunBatch
+  template <class F>
+  void runIfFoundBatch(const K *ks, std::size_t n, F &&functor) {
+    batchRunIfFound(*this, ks, n, functor);
+  }
+
+  /// Not threadsafe. Stops early if functor returns false.
+  template <class F> void forEach(F &&functor) {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    std::uint64_t ebits = loadEpochBits();
+    for (Table *t = curr.load(std::memory_order_relaxed); t;
+         t = t->next.load(std::memory_order_relaxed)) {
+      for (std::size_t i = t->size; i--;) {
+        Entry &e = t->entries[i];
+        if ((stateOf(e.hash.load(std::memory_order_relaxed), ebits) &
+             (hashmask | movedmask)) == hashmask) {
+          if (!functor(e.value)) {
+            return;
+          }
         }
       }
     }
   }
+
+  /// see TableStats. loadFactor is over the newest table.
+  TableStats stats() const { return counters.snapshot(capacity()); }
 };
 
 template <class T> struct CondVal {
@@ -162,9 +1901,10 @@ template <class F, class... Args> struct EvalWrapVal<void, F, Args...> {
   }
 };
 
-template <class K, class V, class Hash, class Eqer> class ConcurrentCacher {
+template <class K, class V, class Hash, class Eqer, class Mutex = std::mutex>
+class ConcurrentCacher {
 
-  typedef ConcurrentHashMapNoResize<K, V, Hash, Eqer> table_t;
+  typedef ConcurrentHashMapNoResize<K, V, Hash, Eqer, Mutex> table_t;
   table_t tables[2];
   std::atomic<std::size_t> sizes[2];
   /// table_t *main = &tables[flags & 1]
@@ -172,12 +1912,20 @@ template <class K, class V, class Hash, class Eqer> class ConcurrentCacher {
   /// table_t *back = (flags & 2)? other : nullptr
   std::atomic<int> flags;
   std::size_t minSize, maxSize;
+  /// the cacher's own hits and misses, as a lookup that misses the main
+  /// table may still hit the other one
+  mutable TableCounters counters;
+  /// see onEvict
+  std::function<void(const K &, const V &)> evicted;
 
 public:
+  typedef V mapped_type;
+
+  /// alloc goes to both tables, see TableAlloc
   ConcurrentCacher(std::size_t sizeBits, std::size_t minSize,
-                   std::size_t maxSize)
-      : tables{table_t(sizeBits), table_t(sizeBits)}, sizes{{0}, {0}}, flags{0},
-        minSize(minSize), maxSize(maxSize) {}
+                   std::size_t maxSize, TableAlloc alloc = TableAlloc::eager)
+      : tables{table_t(sizeBits, alloc), table_t(sizeBits, alloc)},
+        sizes{{0}, {0}}, flags{0}, minSize(minSize), maxSize(maxSize) {}
 
   template <class F>
   decltype(std::declval<F>()(std::declval<V &>(), false))
@@ -193,7 +1941,8 @@ public:
     if (flagsl & 2) {
       CondVal<ret_t> val = mp->runIfFound(
           k,
-          [&functor](V &val) -> CondVal<ret_t> {
+          [this, &functor](V &val) -> CondVal<ret_t> {
+            counters.hit();
             return EvalCondVal<ret_t, F &, V &, bool>{}(functor, val, false);
           },
           {});
@@ -205,6 +1954,7 @@ public:
           k,
           [this, &needClearM, &os, &functor](V &val,
                                              bool isNew) -> WrapVal<ret_t> {
+            isNew ? counters.missed() : counters.hit();
             if (isNew) {
               needClearM =
                   os->fetch_add(1, std::memory_order_relaxed) >= minSize;
@@ -214,7 +1964,14 @@ public:
       if (needClearM) {
         if (flags.compare_exchange_strong(flagsl, flagsl0,
                                           std::memory_order_relaxed)) {
-          ms->store(0, std::memory_order_relaxed);
+          counters.evicted(ms->exchange(0, std::memory_order_relaxed));
+          counters.flipped();
+          if (evicted) {
+            mp->forEach([this](const std::pair<K, V> &val) -> bool {
+              evicted(val.first, val.second);
+              return true;
+            });
+          }
           mp->clear();
         }
       }
@@ -223,6 +1980,7 @@ public:
     return mp->findAndRun(
         k,
         [this, flagsl, flagsl0, mp, ms, &functor](V &val, bool isNew) -> ret_t {
+          isNew ? counters.missed() : counters.hit();
           if (isNew) {
             std::size_t cms = ms->fetch_add(1, std::memory_order_relaxed);
             if (cms >= maxSize) {
@@ -239,32 +1997,587 @@ public:
              const decltype(functor(std::declval<V &>())) &def) {
     typedef decltype(functor(std::declval<V &>())) ret_t;
     int flagsl = flags.load(std::memory_order_relaxed);
-    int flagsl1 = flagsl & 1;
-    int flagsl0 = !flagsl1;
-    table_t *mp = &tables[flagsl1];
-    std::atomic<std::size_t> *ms = &sizes[flagsl1];
-    table_t *other = &tables[flagsl0];
-    std::atomic<std::size_t> *os = &sizes[flagsl0];
+    table_t *mp = &tables[flagsl & 1];
+    table_t *other = &tables[!(flagsl & 1)];
     if (flagsl & 2) {
       CondVal<ret_t> val =
           mp->runIfFound(k,
-                         [&functor](V &val) -> CondVal<ret_t> {
+                         [this, &functor](V &val) -> CondVal<ret_t> {
+                           counters.hit();
                            return EvalCondVal<ret_t, F &, V &>{}(functor, val);
                          },
                          {});
       if (val.valid) {
-        return *reinterpret_cast<ret_t *>(val.val);
+        return val();
       }
       return other->runIfFound(k,
-                               [this, flagsl, flagsl0, mp, ms, os, &functor](
-                                   V &val) -> ret_t { return functor(val); },
+                               [this, &functor](V &val) -> ret_t {
+                                 counters.hit();
+                                 return functor(val);
+                               },
                                def);
     }
     return mp->runIfFound(k,
-                          [this, flagsl, flagsl0, mp, ms,
-                           &functor](V &val) -> ret_t { return functor(val); },
+                          [this, &functor](V &val) -> ret_t {
+                            counters.hit();
+                            return functor(val);
+                          },
                           def);
   }
+
+  /// Lock-free runIfFound, see ConcurrentHashMapNoResize::readIfFound.
+  /// functor runs on a copy of the value, so this is only for reading.
+  template <class F>
+  decltype(std::declval<F>()(std::declval<V &>()))
+  readIfFound(const K &k, F &&functor,
+              const decltype(functor(std::declval<V &>())) &def) const {
+    typedef decltype(functor(std::declval<V &>())) ret_t;
+    int flagsl = flags.load(std::memory_order_relaxed);
+    const table_t *mp = &tables[flagsl & 1];
+    const table_t *other = &tables[!(flagsl & 1)];
+    if (flagsl & 2) {
+      CondVal<ret_t> val =
+          mp->readIfFound(k,
+                          [this, &functor](V &val) -> CondVal<ret_t> {
+                            counters.hit();
+                            return EvalCondVal<ret_t, F &, V &>{}(functor, val);
+                          },
+                          {});
+      if (val.valid) {
+        return val();
+      }
+      return other->readIfFound(k,
+                                [this, &functor](V &val) -> ret_t {
+                                  counters.hit();
+                                  return functor(val);
+                                },
+                                def);
+    }
+    return mp->readIfFound(k,
+                           [this, &functor](V &val) -> ret_t {
+                             counters.hit();
+                             return functor(val);
+                           },
+                           def);
+  }
+
+  /// prefetches k in the tables it could be in
+  void prefetch(const K &k) const {
+    int flagsl = flags.load(std::memory_order_relaxed);
+    tables[flagsl & 1].prefetch(k);
+    if (flagsl & 2) {
+      tables[!(flagsl & 1)].prefetch(k);
+    }
+  }
+
+  /// see ConcurrentHashMap::findAndRunBatch
+  template <class F>
+  void findAndRunBatch(const K *ks, std::size_t n, F &&functor) {
+    batchFindAndRun(*this, ks, n, functor);
+  }
+
+  /// see ConcurrentHashMap::runIfFoundBatch
+  template <class F>
+  void runIfFoundBatch(const K *ks, std::size_t n, F &&functor) {
+    batchRunIfFound(*this, ks, n, functor);
+  }
+
+  /// runIfFoundBatch through readIfFound, lock-free and on copies
+  template <class F>
+  void readIfFoundBatch(const K *ks, std::size_t n, F &&functor) const {
+    batchReadIfFound(*this, ks, n, functor);
+  }
+
+  /// same as findAndRun here, see ClockCacher::insertAndRun
+  template <class F>
+  decltype(std::declval<F>()(std::declval<V &>(), false))
+  insertAndRun(const K &k, F &&functor) {
+    return findAndRun(k, std::forward<F>(functor));
+  }
+
+  /// Drops k from whichever table has it, returning whether one did. The
+  /// entry no longer counts towards the next flip.
+  bool erase(const K &k) {
+    bool toreturn = false;
+    for (std::size_t i = 2; i--;) {
+      if (tables[i].erase(k)) {
+        std::size_t s = sizes[i].load(std::memory_order_relaxed);
+        while (s && !sizes[i].compare_exchange_weak(
+                        s, s - 1, std::memory_order_relaxed)) {
+        }
+        toreturn = true;
+      }
+    }
+    return toreturn;
+  }
+
+  /// Has every flip hand the entries it drops to nevicted first, on the
+  /// flipping thread, see ConcurrentHashMapNoResize::forEach. Not
+  /// threadsafe, set it before sharing the cacher.
+  void onEvict(std::function<void(const K &, const V &)> nevicted) {
+    evicted = std::move(nevicted);
+  }
+
+  /// Probes, locks, inserts and load are both tables'. Only runIfFound calls
+  /// that found k count as hits, so a failed runIfFound followed by
+  /// findAndRun counts once. Evictions count the entries a flip dropped.
+  TableStats stats() const {
+    TableStats toreturn = tables[0].stats();
+    toreturn += tables[1].stats();
+    TableStats own = counters.snapshot(1);
+    toreturn.hits = own.hits;
+    toreturn.misses = own.misses;
+    toreturn.evictions = own.evictions;
+    toreturn.flips = own.flips;
+    return toreturn;
+  }
+};
+
+/// ClockCacher's default Score: every entry scores the same, so victims are
+/// left to CLOCK alone
+struct ClockVictims {
+  static const bool scored = false;
+  struct Snapshot {
+    template <class K> double operator()(const K &) const { return 0; }
+  };
+  Snapshot snapshot() const { return {}; }
+};
+
+/**
+  Cacher that evicts one entry at a time with CLOCK, instead of flipping
+  between two tables. A key can only live in the set of 16 slots its hash
+  picks, laid out like the grouped table above: control bytes and a seqlock
+  word per set. Hits set the slot's reference bit, and a miss that needs room
+  (a full set, or maxSize entries cached) sweeps the set's hand past referenced
+  slots, clearing their bits, to the first unreferenced one. If a whole lap
+  finds none and the set still has a free slot, the new entry takes that
+  instead, so the cache can run up to 1/8 over its size rather than drop a
+  hot entry. New entries start unreferenced, so a burst of one-off keys mostly
+  replaces itself and leaves the hot working set alone.
+
+  With Admit, a TinyLFU frequency sketch also sees every miss (and the first
+  hit on a slot since the hand last passed it), and a missed key does not
+  replace a victim that was seen more often. The functor then runs on a
+  temporary value that is not kept.
+
+  A Score with scored set picks victims by key instead: its snapshot() is
+  taken once per eviction and scores each occupied slot's key, and the
+  highest score goes. If none scores above 0, CLOCK decides as usual. See
+  ClockVictims for the interface, and score() to reach the instance.
+
+  Takes the same constructor arguments as ConcurrentCacher so it can stand in
+  for it: 2^sizeBits slots holding about minSize + maxSize entries, the most
+  ConcurrentCacher holds right before it flips.
+*/
+template <class K, class V, class Hash, class Eqer, bool Admit = false,
+          class Score = ClockVictims>
+class ClockCacher {
+
+  typedef std::pair<K, V> value_type;
+
+  static const std::size_t setSize = 16;
+  static const std::uint8_t emptyctrl = 0;
+
+  struct alignas(32) Set {
+    std::uint8_t ctrl[setSize];
+    std::atomic<std::uint32_t> seq;
+    /// reference bits, hits set them without taking the lock
+    std::atomic<std::uint32_t> ref;
+    /// only touched with the lock held
+    std::uint32_t hand;
+  };
+
+  /**
+    Count-min sketch of 4-bit counters, 16 to a word, with 4 rows sharing the
+    words. Once sampleSize increments went in, every counter is halved, so it
+    estimates recent frequency. Increments racing with the halving may get
+    lost, which only makes the estimate a little less exact.
+  */
+  class FrequencySketch {
+
+    static const std::size_t numRows = 4;
+
+    std::size_t wordMask;
+    std::size_t sampleSize;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> words;
+    std::atomic<std::size_t> additions;
+
+    static std::uint64_t rowHash(std::uint64_t mh, std::size_t row) {
+      static const std::uint64_t seeds[numRows] = {
+          0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL,
+          0xcbf29ce484222325ULL};
+      return (mh ^ (mh >> 32)) * seeds[row];
+    }
+    std::atomic<std::uint64_t> &wordOf(std::uint64_t h) const {
+      return words[(h >> 32) & wordMask];
+    }
+    static unsigned shiftOf(std::uint64_t h) { return ((h >> 20) & 15) * 4; }
+
+  public:
+    explicit FrequencySketch(std::size_t capacity)
+        : wordMask((std::size_t(1) << ceilLog2(capacity / 2 + 2)) - 1),
+          sampleSize(10 * capacity + 16),
+          words(new std::atomic<std::uint64_t>[wordMask + 1]), additions{0} {
+      for (std::size_t i = wordMask + 1; i--;) {
+        words[i].store(0, std::memory_order_relaxed);
+      }
+    }
+
+    void increment(std::uint64_t mh) {
+      for (std::size_t row = numRows; row--;) {
+        std::uint64_t h = rowHash(mh, row);
+        std::atomic<std::uint64_t> &w = wordOf(h);
+        unsigned shift = shiftOf(h);
+        std::uint64_t wl = w.load(std::memory_order_relaxed);
+        while (((wl >> shift) & 15) != 15 &&
+               !w.compare_exchange_weak(wl, wl + (std::uint64_t(1) << shift),
+                                        std::memory_order_relaxed)) {
+        }
+      }
+      if (additions.fetch_add(1, std::memory_order_relaxed) + 1 ==
+          sampleSize) {
+        for (std::size_t i = wordMask + 1; i--;) {
+          std::uint64_t wl = words[i].load(std::memory_order_relaxed);
+          words[i].store((wl >> 1) & 0x7777777777777777ULL,
+                         std::memory_order_relaxed);
+        }
+        additions.fetch_sub(sampleSize / 2, std::memory_order_relaxed);
+      }
+    }
+
+    unsigned estimate(std::uint64_t mh) const {
+      unsigned toreturn = 15;
+      for (std::size_t row = numRows; row--;) {
+        std::uint64_t h = rowHash(mh, row);
+        unsigned c =
+            (wordOf(h).load(std::memory_order_relaxed) >> shiftOf(h)) & 15;
+        toreturn = c < toreturn ? c : toreturn;
+      }
+      return toreturn;
+    }
+  };
+
+  std::size_t setBits;
+  std::size_t setMask;
+  std::size_t maxSize;
+  std::unique_ptr<Set[], MaybeMapped<AlignedDeleter>> sets;
+  TableArray<value_type> values;
+  std::atomic<std::size_t> count;
+  FrequencySketch sketch;
+  mutable TableCounters counters;
+  Hash hasher;
+  Eqer eqer;
+  Score scorer;
+  /// see onEvict
+  std::function<void(const K &, const V &)> evicted;
+
+  std::uint64_t mixedHash(const K &k) const {
+    return std::uint64_t(hasher(k)) * 0x9e3779b97f4a7c15ULL;
+  }
+  static std::uint8_t ctrlOf(std::uint64_t mh) { return 0x80 | mh >> 57; }
+  std::size_t setOf(std::uint64_t mh) const {
+    return (mh >> (57 - setBits)) & setMask;
+  }
+
+  static TableAlloc zeroable(TableAlloc alloc) {
+    return std::is_trivially_copyable<K>::value &&
+                   std::is_trivially_copyable<V>::value
+               ? alloc
+               : TableAlloc::eager;
+  }
+
+  static std::unique_ptr<Set[], MaybeMapped<AlignedDeleter>>
+  allocSets(std::size_t numSets, TableAlloc alloc) {
+    if (alloc != TableAlloc::eager) {
+      return mappedArray<Set, AlignedDeleter>(numSets, alloc);
+    }
+    Set *toreturn = alignedArray<Set>(numSets);
+    for (std::size_t i = numSets; i--;) {
+      std::memset(toreturn[i].ctrl, emptyctrl, setSize);
+      toreturn[i].seq.store(0, std::memory_order_relaxed);
+      toreturn[i].ref.store(0, std::memory_order_relaxed);
+      toreturn[i].hand = 0;
+    }
+    return {toreturn, MaybeMapped<AlignedDeleter>{0}};
+  }
+
+  /// sets slot's reference bit, and tells the sketch about the first hit
+  /// since the hand last cleared it
+  void touch(Set &s, std::size_t slot, std::uint64_t mh) {
+    std::uint32_t bit = std::uint32_t(1) << slot;
+    if (!(s.ref.load(std::memory_order_relaxed) & bit)) {
+      s.ref.fetch_or(bit, std::memory_order_relaxed);
+      if (Admit) {
+        sketch.increment(mh);
+      }
+    }
+  }
+
+  /// CLOCK over the occupied slots of a locked set that has some. Unless the
+  /// set is full, gives up with setSize after one lap of referenced slots.
+  std::size_t sweep(Set &s, bool full) {
+    std::uint32_t occupied = ~matchCtrl(s.ctrl, emptyctrl) & 0xffff;
+    for (std::size_t steps = 0; full || steps < setSize; steps++) {
+      std::size_t slot = s.hand;
+      s.hand = (s.hand + 1) & (setSize - 1);
+      std::uint32_t bit = std::uint32_t(1) << slot;
+      if (!(occupied & bit)) {
+        continue;
+      }
+      if (!(s.ref.fetch_and(~bit, std::memory_order_relaxed) & bit)) {
+        return slot;
+      }
+    }
+    return setSize;
+  }
+
+  /// The occupied slot of a locked set that has some with the highest
+  /// Score, or sweep's pick if all score 0.
+  std::size_t farthest(Set &s, const value_type *svals, bool full) {
+    typename Score::Snapshot snap = scorer.snapshot();
+    std::uint32_t occupied = ~matchCtrl(s.ctrl, emptyctrl) & 0xffff;
+    std::size_t toreturn = setSize;
+    double best = 0;
+    for (std::uint32_t m = occupied; m; m &= m - 1) {
+      std::size_t slot = __builtin_ctz(m);
+      double score = snap(svals[slot].first);
+      if (score > best) {
+        best = score;
+        toreturn = slot;
+      }
+    }
+    return toreturn < setSize ? toreturn : sweep(s, full);
+  }
+
+  template <class F>
+  decltype(std::declval<F>()(std::declval<V &>(), false))
+  findAndRun(const K &k, F &functor, bool admit) {
+    std::uint64_t mh = mixedHash(k);
+    std::uint8_t c = ctrlOf(mh);
+    std::size_t si = setOf(mh);
+    Set &s = sets[si];
+    value_type *svals = values.get() + si * setSize;
+    counters.probed(1);
+    SeqLocker sl(s.seq, counters);
+    for (std::uint32_t m = matchCtrl(s.ctrl, c); m; m &= m - 1) {
+      std::size_t slot = __builtin_ctz(m);
+      value_type &val = svals[slot];
+      if (eqer(k, val.first)) {
+        touch(s, slot, mh);
+        counters.hit();
+        WriteDetector<V> wd(sl.written, val.second);
+        return functor(val.second, false);
+      }
+    }
+    counters.missed();
+    if (Admit) {
+      sketch.increment(mh);
+    }
+    std::uint32_t empties = matchCtrl(s.ctrl, emptyctrl);
+    std::size_t slot = setSize;
+    std::size_t countl = count.load(std::memory_order_relaxed);
+    if (empties != 0xffff && (!empties || countl >= maxSize)) {
+      bool full = !empties || countl >= maxSize + maxSize / 8;
+      slot = Score::scored ? farthest(s, svals, full) : sweep(s, full);
+    }
+    if (slot < setSize) {
+      if (admit && sketch.estimate(mh) <
+                       sketch.estimate(mixedHash(svals[slot].first))) {
+        counters.rejected();
+        V temp{};
+        return functor(temp, true);
+      }
+      if (evicted) {
+        evicted(svals[slot].first, svals[slot].second);
+      }
+      counters.evicted();
+    } else {
+      slot = __builtin_ctz(empties);
+      count.fetch_add(1, std::memory_order_relaxed);
+    }
+    s.ref.fetch_and(~(std::uint32_t(1) << slot), std::memory_order_relaxed);
+    value_type &val = svals[slot];
+    val.first = k;
+    val.second = V{};
+    s.ctrl[slot] = c;
+    counters.inserted();
+    sl.written = true;
+    return functor(val.second, true);
+  }
+
+public:
+  typedef V mapped_type;
+
+  /// An all-zero set is empty, so alloc is followed whenever K and V are
+  /// trivially copyable. The TinyLFU sketch is always allocated up front.
+  ClockCacher(std::size_t sizeBits, std::size_t minSize, std::size_t maxSize,
+              TableAlloc alloc = TableAlloc::eager)
+      : setBits(sizeBits < 4 ? 0 : sizeBits - 4),
+        setMask((std::size_t(1) << setBits) - 1), maxSize(minSize + maxSize),
+        sets(allocSets(setMask + 1, zeroable(alloc))),
+        values(tableArray<value_type>((setMask + 1) * setSize,
+                                      zeroable(alloc))),
+        count{0}, sketch(Admit ? minSize + maxSize : 0), hasher{}, eqer{},
+        scorer{} {}
+
+  /// the Score instance, for whoever feeds it what it scores against
+  Score &score() { return scorer; }
+
+  /// Like ConcurrentCacher::findAndRun. With Admit, functor may get
+  /// isNew == true on a value that is dropped right after.
+  template <class F>
+  decltype(std::declval<F>()(std::declval<V &>(), false))
+  findAndRun(const K &k, F &&functor) {
+    return findAndRun(k, functor, Admit);
+  }
+
+  /// findAndRun that always keeps k, for entries that must not be lost
+  template <class F>
+  decltype(std::declval<F>()(std::declval<V &>(), false))
+  insertAndRun(const K &k, F &&functor) {
+    return findAndRun(k, functor, false);
+  }
+
+  /// Hands each entry to nevicted right before an insert replaces it, on
+  /// the inserting thread and under its set's lock. Not threadsafe, set it
+  /// before sharing the cacher.
+  void onEvict(std::function<void(const K &, const V &)> nevicted) {
+    evicted = std::move(nevicted);
+  }
+
+  /// drops k, returning whether it was cached
+  bool erase(const K &k) {
+    std::uint64_t mh = mixedHash(k);
+    std::uint8_t c = ctrlOf(mh);
+    std::size_t si = setOf(mh);
+    Set &s = sets[si];
+    value_type *svals = values.get() + si * setSize;
+    SeqLocker sl(s.seq, counters);
+    for (std::uint32_t m = matchCtrl(s.ctrl, c); m; m &= m - 1) {
+      std::size_t slot = __builtin_ctz(m);
+      if (eqer(k, svals[slot].first)) {
+        s.ctrl[slot] = emptyctrl;
+        s.ref.fetch_and(~(std::uint32_t(1) << slot),
+                        std::memory_order_relaxed);
+        count.fetch_sub(1, std::memory_order_relaxed);
+        counters.erased();
+        sl.written = true;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /// pulls k's set and the start of its values into cache ahead of a lookup
+  void prefetch(const K &k) const {
+    std::size_t si = setOf(mixedHash(k));
+    __builtin_prefetch(&sets[si], 1);
+    __builtin_prefetch(values.get() + si * setSize, 1);
+  }
+
+  /// see ConcurrentHashMap::findAndRunBatch
+  template <class F>
+  void findAndRunBatch(const K *ks, std::size_t n, F &&functor) {
+    batchFindAndRun(*this, ks, n, functor);
+  }
+
+  /// see ConcurrentHashMap::runIfFoundBatch
+  template <class F>
+  void runIfFoundBatch(const K *ks, std::size_t n, F &&functor) {
+    batchRunIfFound(*this, ks, n, functor);
+  }
+
+  /// see ConcurrentCacher::readIfFoundBatch
+  template <class F>
+  void readIfFoundBatch(const K *ks, std::size_t n, F &&functor) {
+    batchReadIfFound(*this, ks, n, functor);
+  }
+
+  /// Lock-free like ConcurrentHashMapNoResize::readIfFound, functor runs on
+  /// a copy. A set that is being written is read again once the write is
+  /// done.
+  template <class F>
+  decltype(std::declval<F>()(std::declval<V &>()))
+  readIfFound(const K &k, F &&functor,
+              const decltype(functor(std::declval<V &>())) &def) {
+    static_assert(std::is_trivially_copyable<K>::value &&
+                      std::is_trivially_copyable<V>::value,
+                  "readIfFound copies entries bytewise");
+    std::uint64_t mh = mixedHash(k);
+    std::uint8_t c = ctrlOf(mh);
+    std::size_t si = setOf(mh);
+    Set &s = sets[si];
+    const value_type *svals = values.get() + si * setSize;
+    typename std::aligned_storage<sizeof(value_type),
+                                  alignof(value_type)>::type snap;
+    value_type &val = *reinterpret_cast<value_type *>(&snap);
+    std::size_t slot = 0;
+    bool found, stable;
+    std::size_t spins = 0;
+    counters.probed(1);
+    do {
+      std::uint32_t seq = s.seq.load(std::memory_order_acquire);
+      if (seq & 1) {
+        readBackoff(spins++);
+        stable = false;
+        continue;
+      }
+      std::uint8_t ctrl[setSize];
+      std::memcpy(ctrl, s.ctrl, setSize);
+      found = false;
+      for (std::uint32_t m = matchCtrl(ctrl, c); m && !found; m &= m - 1) {
+        slot = __builtin_ctz(m);
+        std::memcpy(&snap, svals + slot, sizeof(value_type));
+        found = eqer(k, val.first);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      stable = s.seq.load(std::memory_order_relaxed) == seq;
+      if (!stable) {
+        readBackoff(spins++);
+      }
+    } while (!stable);
+    if (!found) {
+      return def;
+    }
+    touch(s, slot, mh);
+    counters.hit();
+    return functor(val.second);
+  }
+
+  /// Like ConcurrentCacher::runIfFound: functor runs on the cached value,
+  /// under the set's lock, so what it writes stays.
+  template <class F>
+  decltype(std::declval<F>()(std::declval<V &>()))
+  runIfFound(const K &k, F &&functor,
+             const decltype(functor(std::declval<V &>())) &def) {
+    std::uint64_t mh = mixedHash(k);
+    std::uint8_t c = ctrlOf(mh);
+    std::size_t si = setOf(mh);
+    Set &s = sets[si];
+    value_type *svals = values.get() + si * setSize;
+    counters.probed(1);
+    SeqLocker sl(s.seq, counters);
+    for (std::uint32_t m = matchCtrl(s.ctrl, c); m; m &= m - 1) {
+      std::size_t slot = __builtin_ctz(m);
+      value_type &val = svals[slot];
+      if (eqer(k, val.first)) {
+        touch(s, slot, mh);
+        counters.hit();
+        WriteDetector<V> wd(sl.written, val.second);
+        return functor(val.second);
+      }
+    }
+    return def;
+  }
+
+  /// see TableStats. Like ConcurrentCacher, runIfFound only counts hits, so
+  /// a failed runIfFound followed by findAndRun counts as one miss.
+  TableStats stats() const {
+    TableStats toreturn = counters.snapshot(setSize * (setMask + 1));
+    toreturn.loadFactor = double(count.load(std::memory_order_relaxed)) /
+                          (setSize * (setMask + 1));
+    return toreturn;
+  }
 };
 
 } // namespace hypervoxel
@@ -40,8 +40,10 @@ template <std::size_t N> class FacesManager {
     v::DVec<3> edges[2 * N][2];
   };
 
-  typedef ConcurrentHashMapNoResize<Face, Entry, FaceHash, std::equal_to<Face>>
-      umap;
+  typedef ConcurrentHashMap<Face, Entry, FaceHash, std::equal_to<Face>> umap;
+
+  /// the map grows from here with the render distance
+  static const std::size_t initialSizeBits = 10;
 
   umap map;
   std::size_t currSizes[MAX_THREADS]{0};
@@ -49,34 +51,10 @@ template <std::size_t N> class FacesManager {
   std::size_t threadLocalMaxSize;
   v::DVec<N> cam;
 
-  template <class GetColor>
-  void storeEdge(const v::IVec<N> &coord, std::size_t dim,
-                 const GetColor &getColor, const v::DVec<3> &a,
-                 const v::DVec<3> &b, std::size_t threadi) {
-    map.findAndRun(Face{coord, dim},
-                   [this, &getColor, &a, &b, threadi](Entry &e, bool) -> void {
-                     if (!e.edgeCount) {
-                       currSizes[threadi]++;
-                       e.color = getColor();
-                     }
-                     e.edges[e.edgeCount][0] = a;
-                     e.edges[e.edgeCount++][1] = b;
-                   });
-  }
-
-  template <class BlockData>
-  void storeEdge(const v::IVec<N> &coord, std::size_t dim,
-                 const BlockData &bdata, std::size_t param, const v::DVec<3> &a,
-                 const v::DVec<3> &b, std::size_t threadi) {
-    storeEdge(coord, dim,
-              [&bdata, param]() -> Color { return bdata.getColor(param); }, a,
-              b, threadi);
-  }
-
 public:
   FacesManager(std::size_t maxSize, std::size_t threadLocalMaxSize,
                const v::DVec<N> &cam)
-      : map(ceilLog2(maxSize) + 1), maxSize(maxSize),
+      : map(initialSizeBits), maxSize(maxSize),
         threadLocalMaxSize(threadLocalMaxSize), cam(cam) {}
 
   FacesManager() : map(4), maxSize(8) {}
@@ -119,61 +97,77 @@ public:
       tdim2 += N;
     }
 
-    auto front = terGen(coord);
-    coord[dim1] += mod1;
-    auto s1 = terGen(coord);
-    coord[dim2] += mod2;
-    auto back = terGen(coord);
-    coord[dim1] -= mod1;
-    auto s2 = terGen(coord);
-    coord[dim2] -= mod2;
-
-    if (!front.isOpaque()) {
-      if (s1.isVisible()) {
-        coord[dim1] += cmod1;
-        storeEdge(coord, dim1, s1, tdim1, a, b, threadi);
-        coord[dim1] -= cmod1;
-      }
-      if (s2.isVisible()) {
-        coord[dim2] += cmod2;
-        storeEdge(coord, dim2, s2, tdim2, a, b, threadi);
-        coord[dim2] -= cmod2;
-      }
+    // front, s1, back, s2, and which of them are opaque and visible
+    typedef typename TerGen::blockdata BData;
+    BData bdatas[4];
+    terGen.getQuad(coord, dim1, dim2, mod1, mod2, bdatas);
+    std::uint32_t opaque = 0, visible = 0;
+    for (std::size_t i = 0; i < 4; i++) {
+      opaque |= std::uint32_t(bdatas[i].isOpaque()) << i;
+      visible |= std::uint32_t(bdatas[i].isVisible()) << i;
     }
-    if (back.isVisible()) {
-      if (!s1.isOpaque()) {
-        coord[dim1] += mod1;
-        coord[dim2] += cmod2;
-        storeEdge(coord, dim2, back, tdim2, a, b, threadi);
-        coord[dim2] -= cmod2;
-        coord[dim1] -= mod1;
-      }
-      if (!s2.isOpaque()) {
-        coord[dim2] += mod2;
-        coord[dim1] += cmod1;
-        storeEdge(coord, dim1, back, tdim1, a, b, threadi);
-        coord[dim1] -= cmod1;
-        coord[dim2] -= mod2;
-      }
+    // bits 1 and 3: faces of s1 and s2 seen from an open front, bits 0 and
+    // 2: faces of a visible back seen from open s1 and s2
+    std::uint32_t frontOpen = 0u - (~opaque & 1);
+    std::uint32_t backVisible = 0u - ((visible >> 2) & 1);
+    std::uint32_t faceBits =
+        (frontOpen & visible & 0xa) | (backVisible & ~opaque & 0xa) >> 1;
+    if (!faceBits) {
+      return true;
     }
+
+    // faces to store the edge on, and the block and direction of each color
+    Face faces[4];
+    const BData *colorBlocks[4];
+    std::size_t colorDirs[4];
+    std::size_t numFaces = 0;
+    auto addFace = [&](const v::IVec<N> &c, std::size_t dim, std::int32_t cmod,
+                       const BData &bdata, std::size_t dir) -> void {
+      faces[numFaces] = Face{c, dim};
+      faces[numFaces].c[dim] += cmod;
+      colorBlocks[numFaces] = &bdata;
+      colorDirs[numFaces++] = dir;
+    };
+    if (faceBits & 2) {
+      addFace(coord, dim1, cmod1, bdatas[1], tdim1);
+    }
+    if (faceBits & 8) {
+      addFace(coord, dim2, cmod2, bdatas[3], tdim2);
+    }
+    if (faceBits & 1) {
+      v::IVec<N> c1 = coord;
+      c1[dim1] += mod1;
+      addFace(c1, dim2, cmod2, bdatas[2], tdim2);
+    }
+    if (faceBits & 4) {
+      v::IVec<N> c3 = coord;
+      c3[dim2] += mod2;
+      addFace(c3, dim1, cmod1, bdatas[2], tdim1);
+    }
+    map.findAndRunBatch(
+        faces, numFaces,
+        [this, &colorBlocks, &colorDirs, &a, &b,
+         threadi](std::size_t i, Entry &e, bool) -> void {
+          if (!e.edgeCount) {
+            currSizes[threadi]++;
+            e.color = colorBlocks[i]->getColor(colorDirs[i]);
+          }
+          e.edges[e.edgeCount][0] = a;
+          e.edges[e.edgeCount++][1] = b;
+        });
     return true;
   }
 
   float *fillVertexAttribPointer(float *out, float *out_fend) {
     std::atomic_thread_fence(std::memory_order_acquire);
     float *out_end = out_fend - 21 * N * (N - 1) * (N - 2);
-    for (std::size_t i = map.size; i--;) {
+    map.forEach([&out, out_end](typename umap::value_type &e) -> bool {
       if (out >= out_end) {
-        break;
+        return false;
       }
-
-      auto &e = map.table[i];
-      if (e.hash.load(std::memory_order_relaxed) == 0) {
-        continue;
-      }
-      Entry &fe = map.table[i].value.second;
+      Entry &fe = e.second;
       if (fe.edgeCount < 3) {
-        continue;
+        return true;
       }
       float r = fe.color.r;
       float g = fe.color.g;
@@ -210,9 +204,14 @@ public:
         *out++ = b;
         *out++ = a;
       }
-    }
+      return true;
+    });
     return out;
   }
+
+  /// Probe lengths, lock waits and load of the face table, summed over every
+  /// frame. All zero unless built with HYPERVOXEL_CHTBL_STATS.
+  TableStats tableStats() const { return map.stats(); }
 };
 
 } // namespace hypervoxel
@@ -0,0 +1,295 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+
+#include "terrain_generator_perlin.hpp"
+#include "terrain_generator_simplex.hpp"
+
+/// Times each terrain generator over the bricks TerrainCache asks for, a get
+/// per voxel against one generateBrick per brick, and counts the bricks where
+/// the two disagree, which should be none. Generators without generateBrick
+/// are only timed with get. Every get rate is also given relative to
+/// Perlin's in the same dimension. Then Perlin's classify, which stops
+/// summing octaves once the block is decided, is timed against thresholding
+/// get on random voxels, counting the octaves it skipped and the voxels where
+/// it disagrees with get, which should be none. Last, uniformBox, which
+/// proves whole bricks all air or all solid from bounds on the noise, is
+/// timed in front of generateBrick, counting the bricks it settles and those
+/// where it or boundBox is wrong about get, which should be none.
+
+namespace {
+
+const std::size_t numGradVecs = 4096;
+const std::int32_t brickSide = 4;
+const std::size_t voxelsPerRun = std::size_t(1) << 20;
+const std::size_t voxelsPerClassify = std::size_t(1) << 18;
+
+double secsSince(std::chrono::steady_clock::time_point beg) {
+  return std::chrono::duration_cast<std::chrono::duration<double>>(
+             std::chrono::steady_clock::now() - beg)
+      .count();
+}
+
+template <std::size_t N> hypervoxel::v::IVec<N> originOf(std::size_t b) {
+  hypervoxel::v::IVec<N> toreturn;
+  for (std::size_t d = N; d--;) {
+    toreturn[d] = (std::int32_t(b % 7) - 3 + std::int32_t(d * b)) * brickSide;
+    b /= 7;
+  }
+  return toreturn;
+}
+
+template <std::size_t N> std::size_t brickVolume() {
+  std::size_t volume = 1;
+  for (std::size_t d = N; d--;) {
+    volume *= brickSide;
+  }
+  return volume;
+}
+
+/// get for every voxel of brick b, into out
+template <std::size_t N, class TerGen>
+void getBrick(const TerGen &terGen, std::size_t b, double *out) {
+  hypervoxel::v::IVec<N> origin = originOf<N>(b), coord;
+  for (std::size_t i = 0, volume = brickVolume<N>(); i < volume; i++) {
+    for (std::size_t d = 0, rest = i; d < N; d++, rest /= brickSide) {
+      coord[d] = origin[d] + std::int32_t(rest % brickSide);
+    }
+    out[i] = terGen.get(coord);
+  }
+}
+
+struct Result {
+  double brickSecs;
+  std::size_t mismatches;
+};
+
+template <std::size_t N, class TerGen>
+auto benchBrick(const TerGen &terGen, double &sum, int)
+    -> decltype(terGen.generateBrick(hypervoxel::v::IVec<N>(),
+                                     hypervoxel::v::IVec<N>(),
+                                     (double *)nullptr),
+                Result()) {
+  std::size_t volume = brickVolume<N>();
+  std::size_t numBricks = voxelsPerRun / volume;
+  hypervoxel::v::IVec<N> extent;
+  for (std::size_t d = N; d--;) {
+    extent[d] = brickSide;
+  }
+  std::unique_ptr<double[]> byGet(new double[volume]);
+  std::unique_ptr<double[]> byBrick(new double[volume]);
+
+  auto beg = std::chrono::steady_clock::now();
+  for (std::size_t b = 0; b < numBricks; b++) {
+    terGen.generateBrick(originOf<N>(b), extent, byBrick.get());
+    sum -= byBrick[0];
+  }
+  double brickSecs = secsSince(beg);
+
+  std::size_t mismatches = 0;
+  for (std::size_t b = 0; b < numBricks; b += 16) {
+    getBrick<N>(terGen, b, byGet.get());
+    terGen.generateBrick(originOf<N>(b), extent, byBrick.get());
+    mismatches +=
+        std::memcmp(byGet.get(), byBrick.get(), volume * sizeof(double)) != 0;
+  }
+  return {brickSecs, mismatches};
+}
+
+template <std::size_t N, class TerGen>
+Result benchBrick(const TerGen &, double &, long) {
+  return {0, 0};
+}
+
+/// Prints a row for terGen, returning its get rate. perlinRate is Perlin's,
+/// or 0 if this is Perlin.
+template <std::size_t N, class TerGen>
+double bench(const char *name, const TerGen &terGen, double perlinRate) {
+  std::size_t volume = brickVolume<N>();
+  std::size_t numBricks = voxelsPerRun / volume;
+  std::unique_ptr<double[]> vals(new double[volume]);
+
+  double sum = 0;
+  auto beg = std::chrono::steady_clock::now();
+  for (std::size_t b = 0; b < numBricks; b++) {
+    getBrick<N>(terGen, b, vals.get());
+    sum += vals[volume - 1];
+  }
+  double getSecs = secsSince(beg);
+  Result brick = benchBrick<N>(terGen, sum, 0);
+
+  std::size_t voxels = numBricks * volume;
+  double getRate = voxels / getSecs;
+  std::cout << name << "\t" << N << "\t" << getRate << "\t"
+            << (perlinRate ? getRate / perlinRate : 1) << "\t";
+  if (brick.brickSecs) {
+    std::cout << voxels / brick.brickSecs << "\t" << getSecs / brick.brickSecs
+              << "\t" << brick.mismatches << std::endl;
+  } else {
+    std::cout << "-\t-\t-" << std::endl;
+  }
+  if (sum == 1) {
+    std::cout << "(unlikely)" << std::endl;
+  }
+  return getRate;
+}
+
+template <std::size_t N>
+typename hypervoxel::TerrainGeneratorPerlin<N>::Options
+generatorOptions(double *gradVecs) {
+  typename hypervoxel::TerrainGeneratorPerlin<N>::Options options;
+  for (std::size_t d = N; d--;) {
+    options.scale[d] = 32;
+  }
+  options.gradVecs = gradVecs;
+  options.numGradVecsMask = numGradVecs - 1;
+  options.numOctaves = 3;
+  options.persistence = 0.5;
+  return options;
+}
+
+template <std::size_t N> void benchClassify() {
+  typedef hypervoxel::TerrainGeneratorPerlin<N> TerGen;
+  std::unique_ptr<double[]> gradVecs =
+      hypervoxel::getGradVecs(numGradVecs, N, 2);
+  TerGen terGen{generatorOptions<N>(gradVecs.get())};
+  std::unique_ptr<hypervoxel::v::IVec<N>[]> coords(
+      new hypervoxel::v::IVec<N>[voxelsPerClassify]);
+  std::mt19937 mtrand(N);
+  std::uniform_int_distribution<std::int32_t> dist(-(1 << 20), 1 << 20);
+  for (std::size_t i = voxelsPerClassify; i--;) {
+    for (std::size_t d = N; d--;) {
+      coords[i][d] = dist(mtrand);
+    }
+  }
+  std::unique_ptr<bool[]> byGet(new bool[voxelsPerClassify]);
+
+  auto beg = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < voxelsPerClassify; i++) {
+    byGet[i] = terGen.get(coords[i]) > TerGen::threshold;
+  }
+  double getSecs = secsSince(beg);
+
+  hypervoxel::OctaveStats stats = {};
+  std::size_t mismatches = 0;
+  beg = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < voxelsPerClassify; i++) {
+    mismatches += terGen.classify(coords[i], stats).val != byGet[i];
+  }
+  double classifySecs = secsSince(beg);
+
+  std::cout << "perlin\t" << N << "\t" << voxelsPerClassify / getSecs << "\t"
+            << voxelsPerClassify / classifySecs << "\t"
+            << getSecs / classifySecs << "\t"
+            << double(stats.octavesSkipped) /
+                   (stats.octavesRun + stats.octavesSkipped)
+            << "\t" << mismatches << std::endl;
+}
+
+template <std::size_t N> void benchUniform() {
+  typedef hypervoxel::TerrainGeneratorPerlin<N> TerGen;
+  std::unique_ptr<double[]> gradVecs =
+      hypervoxel::getGradVecs(numGradVecs, N, 2);
+  TerGen terGen{generatorOptions<N>(gradVecs.get())};
+  std::size_t volume = brickVolume<N>();
+  std::size_t numBricks = voxelsPerRun / volume;
+  hypervoxel::v::IVec<N> extent;
+  for (std::size_t d = N; d--;) {
+    extent[d] = brickSide;
+  }
+  std::unique_ptr<typename TerGen::blockdata[]> blocks(
+      new typename TerGen::blockdata[volume]);
+
+  std::size_t sum = 0;
+  auto beg = std::chrono::steady_clock::now();
+  for (std::size_t b = 0; b < numBricks; b++) {
+    terGen.generateBrick(originOf<N>(b), extent, blocks.get());
+    sum += blocks[0].val;
+  }
+  double brickSecs = secsSince(beg);
+
+  std::size_t uniform = 0;
+  beg = std::chrono::steady_clock::now();
+  for (std::size_t b = 0; b < numBricks; b++) {
+    typename TerGen::blockdata val;
+    if (terGen.uniformBox(originOf<N>(b), extent, val)) {
+      uniform++;
+      sum += val.val;
+    } else {
+      terGen.generateBrick(originOf<N>(b), extent, blocks.get());
+      sum += blocks[0].val;
+    }
+  }
+  double uniformSecs = secsSince(beg);
+
+  std::unique_ptr<double[]> vals(new double[volume]);
+  std::size_t wrong = 0;
+  for (std::size_t b = 0; b < numBricks; b += 16) {
+    getBrick<N>(terGen, b, vals.get());
+    double lo, hi;
+    terGen.boundBox(originOf<N>(b), extent, lo, hi);
+    typename TerGen::blockdata val;
+    bool isUniform = terGen.uniformBox(originOf<N>(b), extent, val);
+    bool bad = false;
+    for (std::size_t i = volume; i--;) {
+      bad |= vals[i] < lo || vals[i] > hi ||
+             (isUniform && (vals[i] > TerGen::threshold) != val.val);
+    }
+    wrong += bad;
+  }
+
+  std::cout << "perlin\t" << N << "\t" << voxelsPerRun / brickSecs << "\t"
+            << voxelsPerRun / uniformSecs << "\t" << brickSecs / uniformSecs
+            << "\t" << double(uniform) / numBricks << "\t" << wrong
+            << std::endl;
+  if (sum == 1) {
+    std::cout << "(unlikely)" << std::endl;
+  }
+}
+
+template <std::size_t N> void benchGenerators() {
+  std::unique_ptr<double[]> gradVecs =
+      hypervoxel::getGradVecs(numGradVecs, N, 2);
+  typename hypervoxel::TerrainGeneratorPerlin<N>::Options options =
+      generatorOptions<N>(gradVecs.get());
+  double perlinRate =
+      bench<N>("perlin", hypervoxel::TerrainGeneratorPerlin<N>{options}, 0);
+  bench<N>("simplex", hypervoxel::TerrainGeneratorSimplex<N>{options},
+           perlinRate);
+}
+
+} // namespace
+
+int main() {
+  std::cout << "# " << voxelsPerRun << " voxels in bricks of side "
+            << brickSide << ", 3 octaves" << std::endl;
+  std::cout << "generator\tN\tget_voxels_per_sec\tget_vs_perlin\t"
+               "brick_voxels_per_sec\tspeedup\tbricks_differing"
+            << std::endl;
+  benchGenerators<3>();
+  benchGenerators<4>();
+  benchGenerators<5>();
+  benchGenerators<6>();
+
+  std::cout << "# " << voxelsPerClassify << " random voxels, 3 octaves"
+            << std::endl;
+  std::cout << "classifier\tN\tget_voxels_per_sec\tclassify_voxels_per_sec\t"
+               "speedup\toctaves_skipped\tvoxels_differing"
+            << std::endl;
+  benchClassify<3>();
+  benchClassify<4>();
+  benchClassify<5>();
+  benchClassify<6>();
+
+  std::cout << "# " << voxelsPerRun << " voxels in bricks of side "
+            << brickSide << ", 3 octaves" << std::endl;
+  std::cout << "bounder\tN\tbrick_voxels_per_sec\tbounded_voxels_per_sec\t"
+               "speedup\tbricks_uniform\tbricks_wrong"
+            << std::endl;
+  benchUniform<3>();
+  benchUniform<4>();
+  benchUniform<5>();
+  benchUniform<6>();
+}
@@ -96,7 +96,7 @@ public:
       if (shouldTerm) {
         return;
       }
-      for (lines += threadi; lines <= lines_end; lines += numThreads) {
+      for (lines += threadi; lines < lines_end; lines += numThreads) {
         if (lines->a3[2] > dist2 || lines->b3[2] < dist1) {
           continue;
         }
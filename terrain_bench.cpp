@@ -0,0 +1,145 @@
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sys/stat.h>
+#include <vector>
+
+#include "terrain_generator_perlin.hpp"
+#include "terrain_renderer.hpp"
+
+/// Renders the same camera path with each TerrainCache eviction policy, and
+/// prints how the cache did. Pass a file of camera positions (4 numbers per
+/// line) to replay a recorded path, otherwise the camera flies out and back.
+/// A directory, with or without a path file, adds two runs with a
+/// TerrainStore there, the first one filling it if it is empty, the second
+/// loading from it.
+
+namespace {
+
+const std::size_t numGradVecs = 4096;
+const std::size_t terCacheMin = 1000;
+const std::size_t terCacheMax = 3000;
+
+hypervoxel::TerrainGeneratorPerlin<4>::Options
+generatorOptions(double *gradVecs) {
+  return {{32, 32, 32, 32}, gradVecs, numGradVecs - 1, 3, 0.5};
+}
+
+std::vector<hypervoxel::v::DVec<4>> defaultPath() {
+  std::vector<hypervoxel::v::DVec<4>> path;
+  hypervoxel::v::DVec<4> cam = {0.1, 0.1, 0.1, 0.1};
+  for (std::size_t i = 0; i < 60; i++) {
+    path.push_back(cam);
+    cam[0] += 0.5;
+    cam[1] += 0.25;
+  }
+  for (std::size_t i = 0; i < 60; i++) {
+    path.push_back(cam);
+    cam[0] -= 0.5;
+    cam[1] -= 0.25;
+  }
+  return path;
+}
+
+template <class Eviction>
+void replay(const char *policy,
+            const std::vector<hypervoxel::v::DVec<4>> &path, double *gradVecs,
+            std::size_t numPrefetchThreads = 0,
+            const char *storeDir = nullptr, std::size_t coldSize = 0) {
+  typedef hypervoxel::TerrainGeneratorPerlin<4> TerGen;
+  typedef typename hypervoxel::TerrainCache<4, TerGen, Eviction>::Store Store;
+  double pdists[] = {25, 25, 25, 25};
+  double sq12 = std::sqrt(.5);
+  hypervoxel::SliceDirs<4> sd = {{0.1, 0.1, 0.1, 0.1},
+                                 {0, 0, sq12, -sq12},
+                                 {.5, .5, -.5, -.5},
+                                 {sq12, -sq12, 0, 0},
+                                 1,
+                                 1};
+  std::unique_ptr<Store> store;
+  if (storeDir) {
+    store.reset(
+        new Store(storeDir, TerGen{generatorOptions(gradVecs)}.seed()));
+  }
+  hypervoxel::TerrainRenderer<4, TerGen, Eviction> renderer(
+      TerGen{generatorOptions(gradVecs)}, terCacheMin, terCacheMax, 100000, 4,
+      pdists, sd, numPrefetchThreads, coldSize);
+  renderer.attachStore(store.get());
+  const std::size_t lenTriangles = 21 * 1048576;
+  std::unique_ptr<float[]> triangles(new float[lenTriangles]);
+  auto beg = std::chrono::steady_clock::now();
+  for (const hypervoxel::v::DVec<4> &cam : path) {
+    sd.cam = cam;
+    renderer.writeTriangles(sd, triangles.get(),
+                            triangles.get() + lenTriangles);
+  }
+  double secs = std::chrono::duration_cast<std::chrono::duration<double>>(
+                    std::chrono::steady_clock::now() - beg)
+                    .count();
+  hypervoxel::TableStats stats = renderer.terrainCacheStats();
+  hypervoxel::TableStats fstats = renderer.facesTableStats();
+  hypervoxel::PrefetchStats pstats = renderer.prefetchStats();
+  std::cout << policy << "\t" << path.size() << "\t" << stats.hits << "\t"
+            << stats.misses << "\t" << stats.evictions << "\t"
+            << stats.rejections << "\t"
+            << double(stats.hits) / (stats.hits + stats.misses) << "\t"
+            << stats.blockedLocks << "\t" << renderer.generationWaits() << "\t"
+            << renderer.uniformBricks() << "\t" << fstats.blockedLocks << "\t"
+            << pstats.generated << "\t" << secs << std::endl;
+  if (coldSize) {
+    hypervoxel::ColdTierStats cstats = renderer.coldTierStats();
+    std::cout << "# cold tier: demoted " << cstats.demoted
+              << " uniform " << cstats.uniform << " dropped "
+              << cstats.dropped << " promoted " << cstats.promoted
+              << ", bits per block hot " << cstats.hotBitsPerBlock
+              << " cold " << cstats.coldBitsPerBlock << std::endl;
+  }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  std::ios_base::sync_with_stdio(false);
+  std::vector<hypervoxel::v::DVec<4>> path;
+  const char *storeDir = nullptr;
+  for (int i = 1; i < argc; i++) {
+    struct stat st;
+    if (!stat(argv[i], &st) && S_ISDIR(st.st_mode)) {
+      storeDir = argv[i];
+      continue;
+    }
+    std::ifstream in(argv[i]);
+    hypervoxel::v::DVec<4> cam;
+    while (in >> cam[0] >> cam[1] >> cam[2] >> cam[3]) {
+      path.push_back(cam);
+    }
+  }
+  if (path.empty()) {
+    path = defaultPath();
+  }
+  std::unique_ptr<double[]> gradVecs =
+      hypervoxel::getGradVecs(numGradVecs, 4, 2);
+
+  std::cout << "# terrain cache holding " << terCacheMin << " to "
+            << terCacheMax << " bricks" << std::endl;
+  std::cout << "policy\tframes\thits\tmisses\tevictions\trejections\thit_"
+               "rate\tblocked\tgen_waits\tuniform\tfaces_blocked\tprefetched\t"
+               "secs"
+            << std::endl;
+  replay<hypervoxel::FlipEviction>("flip", path, gradVecs.get());
+  replay<hypervoxel::ClockEviction>("clock", path, gradVecs.get());
+  replay<hypervoxel::ClockTinyLFUEviction>("clock_tinylfu", path,
+                                           gradVecs.get());
+  replay<hypervoxel::SliceEviction>("slice", path, gradVecs.get());
+  replay<hypervoxel::FlipEviction>("flip_prefetch", path, gradVecs.get(), 1);
+  replay<hypervoxel::FlipEviction>("flip_cold", path, gradVecs.get(), 1,
+                                   nullptr, 4 * terCacheMax);
+  if (storeDir) {
+    replay<hypervoxel::FlipEviction>("flip_store", path, gradVecs.get(), 0,
+                                     storeDir);
+    replay<hypervoxel::FlipEviction>("flip_store", path, gradVecs.get(), 0,
+                                     storeDir);
+  }
+}
@@ -1,54 +1,736 @@
 #ifndef HYPERVOXEL_TERRAIN_CACHE_HPP_
 #define HYPERVOXEL_TERRAIN_CACHE_HPP_
 
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
 #include <unordered_map>
+#include <vector>
 
 #include "concurrent_hashtable.hpp"
+#include "primitives.hpp"
+#include "terrain_cold_tier.hpp"
+#include "terrain_store.hpp"
 #include "vector.hpp"
 
 namespace hypervoxel {
 
-template <std::size_t N, class TerGen> class TerrainCache {
+/// TerrainCache eviction: keep filling one table, then flip to the other and
+/// drop the first once minSize entries went into the second
+struct FlipEviction {
+  template <class K, class V, class Hash, class Eq>
+  using cacher = ConcurrentCacher<K, V, Hash, Eq, GroupTagLock>;
+};
+
+/// TerrainCache eviction: CLOCK within small sets, see ClockCacher
+struct ClockEviction {
+  template <class K, class V, class Hash, class Eq>
+  using cacher = ClockCacher<K, V, Hash, Eq, false>;
+};
+
+/// ClockEviction that keeps blocks out that are asked for less often than the
+/// ones they would replace, so far-away blocks seen once do not push out the
+/// ones around the camera
+struct ClockTinyLFUEviction {
+  template <class K, class V, class Hash, class Eq>
+  using cacher = ClockCacher<K, V, Hash, Eq, true>;
+};
+
+/**
+  ClockCacher Score for SliceEviction: how far a brick of Side blocks, at
+  key, lies from what the slice setSlice was last given can see, squared.
+  That is its distance off the slice's 3D subspace, plus how far outside
+  the view frustum, range blocks deep, it lies within it, each less half the
+  brick's diagonal. Bricks in view score 0, as does everything before the
+  first setSlice.
+
+  setSlice publishes with a seqlock, so evicting threads read the slice
+  without a lock.
+*/
+template <std::size_t N, std::size_t Side> class SliceScore {
+
+public:
+  struct Snapshot {
+    v::DVec<N> cam, right, up, forward;
+    double width2, height2, range;
+    bool valid;
+
+    double operator()(const v::IVec<N> &key) const {
+      if (!valid) {
+        return 0;
+      }
+      double d2 = 0, r = 0, u = 0, f = 0;
+      for (std::size_t i = N; i--;) {
+        double d = (key[i] + .5) * double(Side) - cam[i];
+        d2 += d * d;
+        r += d * right[i];
+        u += d * up[i];
+        f += d * forward[i];
+      }
+      double in2 = r * r + u * u + f * f;
+      double margin = Side * std::sqrt(double(N)) / 2;
+      double fc = f < 0 ? 0 : f > range ? range : f;
+      double out[] = {std::sqrt(d2 > in2 ? d2 - in2 : 0),
+                      f < 0 ? -f : f - range, std::abs(r) - width2 * fc,
+                      std::abs(u) - height2 * fc};
+      double toreturn = 0;
+      for (double o : out) {
+        o -= margin;
+        toreturn += o > 0 ? o * o : 0;
+      }
+      return toreturn;
+    }
+  };
+
+private:
+  static_assert(std::is_trivially_copyable<Snapshot>::value,
+                "SliceScore copies its slice bytewise");
+
+  Snapshot slice;
+  std::atomic<std::uint32_t> seq;
+
+public:
+  static const bool scored = true;
+
+  SliceScore() : seq{0} { slice.valid = false; }
+
+  /// Scores against sd, seeing range blocks ahead. Only one thread may call
+  /// it at a time.
+  void setSlice(const SliceDirs<N> &sd, double range) {
+    std::uint32_t s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slice = Snapshot{sd.cam,    sd.right,   sd.up, sd.forward,
+                     sd.width2, sd.height2, range, true};
+    seq.store(s + 2, std::memory_order_release);
+  }
+
+  Snapshot snapshot() const {
+    typename std::aligned_storage<sizeof(Snapshot),
+                                  alignof(Snapshot)>::type snap;
+    std::uint32_t s;
+    do {
+      s = seq.load(std::memory_order_acquire);
+      std::memcpy(&snap, &slice, sizeof(Snapshot));
+      std::atomic_thread_fence(std::memory_order_acquire);
+    } while ((s & 1) || seq.load(std::memory_order_relaxed) != s);
+    return *reinterpret_cast<Snapshot *>(&snap);
+  }
+};
+
+/// TerrainCache eviction: the brick farthest from the slice goes first, and
+/// CLOCK picks among bricks the slice can see. Needs TerrainCache::setSlice
+/// every frame, which TerrainRenderer does.
+struct SliceEviction {
+  template <class K, class V, class Hash, class Eq>
+  using cacher =
+      ClockCacher<K, V, Hash, Eq, false, SliceScore<K::size, V::side>>;
+};
+
+/**
+  The keys whose bricks some thread is generating right now, so that other
+  threads needing the same brick wait for it instead of generating it too,
+  and the generating thread holds no cache lock meanwhile. Keys hash to one
+  of numStripes stripes, each a mutex, a condition variable and a short list
+  of the stripe's keys in flight.
+*/
+template <class K, class Hash, class Eqer> class InFlightKeys {
+
+  static const std::size_t stripeBits = 6;
+
+  struct Stripe {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<K> keys;
+  };
+
+  Stripe stripes[std::size_t(1) << stripeBits];
+  std::atomic<std::uint64_t> waited;
+  Hash hasher;
+  Eqer eqer;
+
+  Stripe &stripeOf(const K &k) {
+    std::uint64_t h = std::uint64_t(hasher(k)) * 0x9e3779b97f4a7c15ULL;
+    return stripes[h >> (64 - stripeBits)];
+  }
+
+  bool inFlight(const Stripe &s, const K &k) const {
+    for (const K &other : s.keys) {
+      if (eqer(k, other)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+public:
+  InFlightKeys() : waited{0}, hasher{}, eqer{} {}
+
+  /// Claims k and returns true if no thread has it in flight. Otherwise
+  /// waits until the thread that does releases it, and returns false.
+  bool claim(const K &k) {
+    Stripe &s = stripeOf(k);
+    std::unique_lock<std::mutex> lock(s.mutex);
+    if (!inFlight(s, k)) {
+      s.keys.push_back(k);
+      return true;
+    }
+    waited.fetch_add(1, std::memory_order_relaxed);
+    s.cond.wait(lock, [this, &s, &k]() -> bool { return !inFlight(s, k); });
+    return false;
+  }
+
+  /// ends claim(k) returning true, waking the threads waiting for k
+  void release(const K &k) {
+    Stripe &s = stripeOf(k);
+    {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      for (std::size_t i = s.keys.size(); i--;) {
+        if (eqer(k, s.keys[i])) {
+          s.keys[i] = s.keys.back();
+          s.keys.pop_back();
+          break;
+        }
+      }
+    }
+    s.cond.notify_all();
+  }
+
+  /// how many claims so far found their key in flight and waited
+  std::uint64_t waits() const { return waited.load(std::memory_order_relaxed); }
+};
+
+/// Where blocks sit in TerrainBricks, see there
+template <std::size_t N, std::size_t Bits> struct BrickIndex {
+  static const std::size_t side = std::size_t(1) << Bits;
+  static const std::size_t volume = std::size_t(1) << (N * Bits);
+  static const std::int32_t sideMask = side - 1;
+
+  /// key of the brick holding coord
+  static v::IVec<N> keyOf(const v::IVec<N> &coord) {
+    v::IVec<N> toreturn;
+    for (std::size_t i = N; i--;) {
+      // arithmetic shift, so negative coords floor like the rest
+      toreturn[i] = coord[i] >> Bits;
+    }
+    return toreturn;
+  }
+
+  /// where coord is in the brick holding it
+  static std::size_t indexOf(const v::IVec<N> &coord) {
+    std::size_t toreturn = 0;
+    for (std::size_t i = N; i--;) {
+      toreturn = (toreturn << Bits) | (coord[i] & sideMask);
+    }
+    return toreturn;
+  }
+
+  /// the block at index in the brick at key
+  static v::IVec<N> coordOf(const v::IVec<N> &key, std::size_t index) {
+    v::IVec<N> toreturn;
+    for (std::size_t i = 0; i < N; i++) {
+      toreturn[i] =
+          key[i] * std::int32_t(side) + std::int32_t(index & sideMask);
+      index >>= Bits;
+    }
+    return toreturn;
+  }
+
+  /// Whether coord + mod1 along dim1 and + mod2 along dim2, mods being 1 or
+  /// -1, are in the brick holding coord. If so, sets quad to the indices of
+  /// coord, the first, both, and the second step.
+  static bool quadIndices(const v::IVec<N> &coord, std::size_t dim1,
+                          std::size_t dim2, std::int32_t mod1,
+                          std::int32_t mod2, std::size_t *quad) {
+    std::int32_t o1 = (coord[dim1] & sideMask) + mod1;
+    std::int32_t o2 = (coord[dim2] & sideMask) + mod2;
+    if ((o1 | o2) & ~sideMask) {
+      return false;
+    }
+    std::size_t s1 = std::size_t(1) << (Bits * dim1);
+    std::size_t s2 = std::size_t(1) << (Bits * dim2);
+    quad[0] = indexOf(coord);
+    quad[1] = mod1 > 0 ? quad[0] + s1 : quad[0] - s1;
+    quad[2] = mod2 > 0 ? quad[1] + s2 : quad[1] - s2;
+    quad[3] = mod2 > 0 ? quad[0] + s2 : quad[0] - s2;
+    return true;
+  }
+};
+
+/// Detects blockdata marked with typedef void thisisabit, whose only state
+/// is its bool val: isOpaque() and isVisible() both return it.
+template <class BData, class = void> struct IsBitBlockdata : std::false_type {};
+template <class BData>
+struct IsBitBlockdata<BData, typename BData::thisisabit> : std::true_type {};
+
+/**
+  A dense N-dimensional block of 2^Bits blocks along each axis, the unit
+  TerrainCache stores. Bricks tile space: the one at key k starts at block
+  k * 2^Bits, and its block at offset o from there sits at
+  index sum(o[i] << (Bits * i)).
+*/
+template <std::size_t N, class BData, std::size_t Bits, class = void>
+struct TerrainBrick : BrickIndex<N, Bits> {
+  typedef BrickIndex<N, Bits> index_t;
+
+  BData vals[index_t::volume];
+
+  BData get(std::size_t index) const { return vals[index]; }
+  void set(std::size_t index, const BData &val) { vals[index] = val; }
+
+  /// sets every block to val
+  void fill(const BData &val) {
+    for (std::size_t i = index_t::volume; i--;) {
+      vals[i] = val;
+    }
+  }
+
+  BData operator[](const v::IVec<N> &coord) const {
+    return vals[index_t::indexOf(coord)];
+  }
+
+  /// the blocks at quad, see BrickIndex::quadIndices
+  void getQuad(const std::size_t *quad, BData *out) const {
+    for (std::size_t i = 0; i < 4; i++) {
+      out[i] = vals[quad[i]];
+    }
+  }
+};
+
+/// TerrainBrick of single-bit blockdata, packed into 64-bit words. A 4^4
+/// brick takes 32 bytes.
+template <std::size_t N, class BData, std::size_t Bits>
+struct TerrainBrick<N, BData, Bits, typename BData::thisisabit>
+    : BrickIndex<N, Bits> {
+  typedef BrickIndex<N, Bits> index_t;
+  static const std::size_t numWords = (index_t::volume + 63) / 64;
+
+  std::uint64_t words[numWords];
+
+  bool bit(std::size_t index) const {
+    return (words[index >> 6] >> (index & 63)) & 1;
+  }
+
+  BData get(std::size_t index) const { return BData{bit(index)}; }
+  void set(std::size_t index, const BData &val) {
+    std::uint64_t mask = std::uint64_t(1) << (index & 63);
+    words[index >> 6] = val.val ? words[index >> 6] | mask
+                                : words[index >> 6] & ~mask;
+  }
+
+  /// sets every block to val, a word at a time
+  void fill(const BData &val) {
+    for (std::size_t i = numWords; i--;) {
+      words[i] = val.val ? ~std::uint64_t(0) : 0;
+    }
+    if (val.val && index_t::volume % 64) {
+      words[numWords - 1] = (std::uint64_t(1) << (index_t::volume % 64)) - 1;
+    }
+  }
+
+  BData operator[](const v::IVec<N> &coord) const {
+    return get(index_t::indexOf(coord));
+  }
+
+  /// The bits at quad as bits 0 to 3, see BrickIndex::quadIndices. With
+  /// the words of a 4^4 brick in registers, this is a few shifts and masks.
+  std::uint32_t quadBits(const std::size_t *quad) const {
+    return std::uint32_t(bit(quad[0])) | std::uint32_t(bit(quad[1])) << 1 |
+           std::uint32_t(bit(quad[2])) << 2 | std::uint32_t(bit(quad[3])) << 3;
+  }
+
+  void getQuad(const std::size_t *quad, BData *out) const {
+    std::uint32_t bits = quadBits(quad);
+    for (std::size_t i = 0; i < 4; i++) {
+      out[i] = BData{bool((bits >> i) & 1)};
+    }
+  }
+};
+
+/**
+  Thread-safe cache in front of a terrain generator. Blocks are generated
+  and cached a whole TerrainBrick at a time, keyed by brick coordinate: the
+  neighbours a lookup is followed by are usually in the same brick, so they
+  cost an array index instead of a hash lookup of their own, and each block
+  takes sizeof(BData) instead of a whole table slot. The default 4^N bricks
+  keep a slot small enough to copy out on lock-free reads.
+*/
+template <std::size_t N, class TerGen, class Eviction = FlipEviction,
+          std::size_t BrickBits = 2>
+class TerrainCache {
 
   typedef typename TerGen::blockdata BData;
 
-  typedef ConcurrentCacher<v::IVec<N>, BData, v::IVecHash<N>,
-                           v::EqualFunctor<v::IVec<N>, v::IVec<N>>>
+public:
+  typedef TerrainBrick<N, BData, BrickBits> Brick;
+  typedef TerrainStore<N, Brick> Store;
+
+private:
+  /// most keys getBatch hands to the cache at once
+  static const std::size_t maxBatch = 8;
+
+  typedef typename Eviction::template cacher<
+      v::IVec<N>, Brick, v::IVecHash<N>,
+      v::EqualFunctor<v::IVec<N>, v::IVec<N>>>
       umap;
 
   TerGen terGen;
   umap cache;
+  InFlightKeys<v::IVec<N>, v::IVecHash<N>,
+               v::EqualFunctor<v::IVec<N>, v::IVec<N>>>
+      inFlight;
+  std::unique_ptr<TerrainColdTier<N, Brick>> cold;
+  Store *store;
+  mutable std::atomic<std::uint64_t> uniform;
+
+  template <class Cacher>
+  static auto setSliceOf(Cacher &c, const SliceDirs<N> &sd, double range, int)
+      -> decltype(c.score().setSlice(sd, range)) {
+    c.score().setSlice(sd, range);
+  }
+  template <class Cacher>
+  static void setSliceOf(Cacher &, const SliceDirs<N> &, double, long) {}
+
+  /// Fills brick with a single value and returns true where TerGen has
+  /// uniformBox and that proves the whole brick air or solid.
+  template <class G = TerGen>
+  auto uniformBlocks(const v::IVec<N> &key, Brick &brick, int) const
+      -> decltype(std::declval<const G &>().uniformBox(
+                      key, key, std::declval<BData &>()),
+                  bool()) {
+    v::IVec<N> extent;
+    for (std::size_t d = N; d--;) {
+      extent[d] = Brick::side;
+    }
+    BData val;
+    if (!terGen.uniformBox(Brick::coordOf(key, 0), extent, val)) {
+      return false;
+    }
+    brick.fill(val);
+    uniform.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  bool uniformBlocks(const v::IVec<N> &, Brick &, long) const {
+    return false;
+  }
+
+  /// fills brick from terGen, in one generateBrick call where TerGen has it
+  template <class G = TerGen>
+  auto generateBlocks(const v::IVec<N> &key, Brick &brick, int) const
+      -> decltype(std::declval<const G &>().generateBrick(key, key,
+                                                          (BData *)nullptr)) {
+    v::IVec<N> extent;
+    for (std::size_t d = N; d--;) {
+      extent[d] = Brick::side;
+    }
+    BData vals[Brick::volume];
+    terGen.generateBrick(Brick::coordOf(key, 0), extent, vals);
+    for (std::size_t i = Brick::volume; i--;) {
+      brick.set(i, vals[i]);
+    }
+  }
+  void generateBlocks(const v::IVec<N> &key, Brick &brick, long) const {
+    for (std::size_t i = Brick::volume; i--;) {
+      brick.set(i, terGen(Brick::coordOf(key, i)));
+    }
+  }
+
+  /// fills brick from the cold tier if promote, the store, or else terGen
+  void generate(const v::IVec<N> &key, Brick &brick, bool promote) const {
+    if (promote && cold && cold->promote(key, brick)) {
+      return;
+    }
+    const Brick *stored = store ? store->find(key) : nullptr;
+    if (stored) {
+      brick = *stored;
+    } else {
+      if (!uniformBlocks(key, brick, 0)) {
+        generateBlocks(key, brick, 0);
+      }
+      if (store) {
+        store->save(key, brick);
+      }
+    }
+  }
+
+  /// Runs functor on a lock-free copy of the brick at key, see
+  /// ConcurrentCacher::readIfFound, and returns whether it is cached.
+  template <class F> bool ifCached(const v::IVec<N> &key, F &&functor) {
+    return cache.readIfFound(key,
+                             [&functor](Brick &b) -> bool {
+                               functor(b);
+                               return true;
+                             },
+                             false);
+  }
+
+  /**
+    Runs functor on the brick at key, generating it first if it is not
+    cached, and returns whether this call generated it. The brick is
+    generated outside the cache's locks, into a local brick that is then
+    copied in, so readers of other bricks in the same set never wait for
+    terGen. Threads missing a brick some other thread is generating wait
+    for that one, see InFlightKeys, and then look again. With promote, a
+    brick the cold tier has is taken from there instead.
+  */
+  template <class F>
+  bool withBrick(const v::IVec<N> &key, F &&functor, bool promote = false) {
+    while (!ifCached(key, functor)) {
+      if (!inFlight.claim(key)) {
+        continue;
+      }
+      // whoever had key in flight may have released it between the miss
+      // and the claim
+      if (ifCached(key, functor)) {
+        inFlight.release(key);
+        return false;
+      }
+      Brick brick;
+      generate(key, brick, promote);
+      cache.findAndRun(key,
+                       [&brick, &functor](Brick &b, bool isNew) -> void {
+                         if (isNew) {
+                           b = brick;
+                         }
+                         functor(b);
+                       });
+      inFlight.release(key);
+      return true;
+    }
+    return false;
+  }
+
+  /// Claims key for a write, waiting out any thread that has it in flight,
+  /// and copies its brick into brick, generating that outside the cache's
+  /// locks if it is not cached. Returns whether it was cached. Until the
+  /// caller releases key, no other thread inserts or writes its brick.
+  bool claimBrick(const v::IVec<N> &key, Brick &brick) {
+    while (!inFlight.claim(key)) {
+    }
+    if (ifCached(key, [&brick](const Brick &b) -> void { brick = b; })) {
+      return true;
+    }
+    generate(key, brick, false);
+    return false;
+  }
 
 public:
-  TerrainCache(TerGen &&terGen, std::size_t minSize, std::size_t maxSize)
-      : terGen(terGen), cache(ceilLog2(maxSize) + 1, minSize, maxSize) {}
+  typedef BData blockdata;
+
+  /// minSize and maxSize count bricks, see ConcurrentCacher. If coldSize is
+  /// not 0, the bricks the cache evicts go to a TerrainColdTier of that
+  /// size, for ensureBrick to bring back.
+  TerrainCache(TerGen &&terGen, std::size_t minSize, std::size_t maxSize,
+               std::size_t coldSize = 0)
+      : terGen(terGen),
+        cache(ceilLog2(maxSize) + 1, minSize, maxSize, TableAlloc::zeroPages),
+        cold(coldSize ? new TerrainColdTier<N, Brick>(coldSize, maxSize)
+                      : nullptr),
+        store(nullptr), uniform{0} {
+    if (cold) {
+      cache.onEvict([this](const v::IVec<N> &key, const Brick &b) -> void {
+        cold->demote(key, b);
+      });
+    }
+  }
+
+  /// Loads missing bricks from nstore before generating them, and saves the
+  /// ones it generates there. nstore has to outlive the cache, or be
+  /// detached with null first. Written blocks are not saved.
+  void attachStore(Store *nstore) { store = nstore; }
 
+  BData operator()(const v::IVec<N> &coord) {
+    BData toreturn;
+    withBrick(Brick::keyOf(coord),
+              [&toreturn, &coord](const Brick &b) -> void {
+                toreturn = b[coord];
+              });
+    return toreturn;
+  }
+
+  /// operator() on coords[0..n), into out. Each chunk of coords looks up
+  /// its distinct bricks together, prefetched before any of them is
+  /// resolved, and copies all of the chunk's blocks out of each. Missing
+  /// bricks are then generated one by one.
+  void getBatch(const v::IVec<N> *coords, std::size_t n, BData *out) {
+    for (std::size_t beg = 0; beg < n; beg += maxBatch) {
+      std::size_t len = n - beg < maxBatch ? n - beg : maxBatch;
+      v::IVec<N> keys[maxBatch];
+      std::size_t keyAt[maxBatch];
+      std::size_t numKeys = 0;
+      for (std::size_t i = 0; i < len; i++) {
+        v::IVec<N> key = Brick::keyOf(coords[beg + i]);
+        std::size_t j = 0;
+        while (j < numKeys && !(keys[j] == key)) {
+          j++;
+        }
+        if (j == numKeys) {
+          keys[numKeys++] = key;
+        }
+        keyAt[i] = j;
+      }
+      auto copyOut = [coords, out, beg, len, &keyAt](std::size_t j,
+                                                     const Brick &b) -> void {
+        for (std::size_t i = 0; i < len; i++) {
+          if (keyAt[i] == j) {
+            out[beg + i] = b[coords[beg + i]];
+          }
+        }
+      };
+      bool found[maxBatch] = {};
+      cache.readIfFoundBatch(
+          keys, numKeys, [&copyOut, &found](std::size_t j, Brick &b) -> void {
+            copyOut(j, b);
+            found[j] = true;
+          });
+      for (std::size_t j = 0; j < numKeys; j++) {
+        if (!found[j]) {
+          withBrick(keys[j],
+                    [&copyOut, j](const Brick &b) -> void { copyOut(j, b); });
+        }
+      }
+    }
+  }
+
+  /// Sets coord's block, generating the rest of its brick if that is not
+  /// cached, see claimBrick.
   void replaceCacheEntry(const v::IVec<N> &coord, BData blockdata) {
-    cache.findAndRun(
-        coord, [blockdata](BData &v, bool isNew) -> void { v = blockdata; });
+    v::IVec<N> key = Brick::keyOf(coord);
+    Brick brick;
+    claimBrick(key, brick);
+    cache.insertAndRun(
+        key, [&brick, &coord, blockdata](Brick &b, bool isNew) -> void {
+          if (isNew) {
+            b = brick;
+          }
+          b.set(Brick::indexOf(coord), blockdata);
+        });
+    inFlight.release(key);
   }
 
+  /// Sets coord's block only if its brick is not cached yet, like
+  /// replaceCacheEntry otherwise.
   void insertCacheEntry(const v::IVec<N> &coord, BData blockdata) {
-    cache.findAndRun(coord, [blockdata](BData &v, bool isNew) -> void {
-      if (isNew) {
-        v = blockdata;
+    v::IVec<N> key = Brick::keyOf(coord);
+    Brick brick;
+    if (!claimBrick(key, brick)) {
+      brick.set(Brick::indexOf(coord), blockdata);
+      cache.insertAndRun(key, [&brick](Brick &b, bool isNew) -> void {
+        if (isNew) {
+          b = brick;
+        }
+      });
+    }
+    inFlight.release(key);
+  }
+
+  /// Drops the brick holding coord, so the next read regenerates it, along
+  /// with any block written into it. Returns whether it was cached.
+  bool eraseCacheEntry(const v::IVec<N> &coord) {
+    return cache.erase(Brick::keyOf(coord));
+  }
+
+  /// Lock-free. Whether the brick at key is cached.
+  bool hasBrick(const v::IVec<N> &key) {
+    return cache.readIfFound(key, [](Brick &) -> bool { return true; },
+                             false);
+  }
+
+  /// Generates the brick at key if it is not cached, or takes it back from
+  /// the cold tier, returning whether it did. For TerrainPrefetcher, which
+  /// calls it ahead of the readers, so only its workers read the cold tier.
+  bool ensureBrick(const v::IVec<N> &key) {
+    return withBrick(key, [](const Brick &) -> void {}, true);
+  }
+
+  /// The blocks at coord + offsets[0..n), into out, for small stencils
+  /// around coord. Each brick the stencil touches is looked up once, and all
+  /// of its blocks copied out of it.
+  void getStencil(const v::IVec<N> &coord, const v::IVec<N> *offsets,
+                  std::size_t n, BData *out) {
+    for (std::size_t i = 0; i < n; i++) {
+      v::IVec<N> key = Brick::keyOf(coord + offsets[i]);
+      std::size_t seen = 0;
+      while (seen < i && !(Brick::keyOf(coord + offsets[seen]) == key)) {
+        seen++;
+      }
+      if (seen < i) {
+        continue;
       }
+      withBrick(key, [&coord, offsets, n, out, i, &key](const Brick &b) {
+        for (std::size_t j = i; j < n; j++) {
+          v::IVec<N> c = coord + offsets[j];
+          if (Brick::keyOf(c) == key) {
+            out[j] = b[c];
+          }
+        }
+      });
+    }
+  }
+
+  /// The blocks at coord, coord + mod1 along dim1, that + mod2 along dim2,
+  /// and coord + mod2 along dim2 (the front, s1, back and s2 of a
+  /// FacesManager edge), into out. A quad within one brick takes a single
+  /// lookup, and packed bricks read it with a few shifts. One spanning
+  /// bricks goes through getStencil.
+  void getQuad(const v::IVec<N> &coord, std::size_t dim1, std::size_t dim2,
+               std::int32_t mod1, std::int32_t mod2, BData *out) {
+    std::size_t quad[4];
+    if (!Brick::quadIndices(coord, dim1, dim2, mod1, mod2, quad)) {
+      v::IVec<N> offsets[4];
+      for (std::size_t i = 4; i--;) {
+        for (std::size_t d = N; d--;) {
+          offsets[i][d] = 0;
+        }
+      }
+      offsets[1][dim1] = offsets[2][dim1] = mod1;
+      offsets[2][dim2] = offsets[3][dim2] = mod2;
+      getStencil(coord, offsets, 4, out);
+      return;
+    }
+    withBrick(Brick::keyOf(coord), [&quad, out](const Brick &b) -> void {
+      b.getQuad(quad, out);
     });
   }
 
-  BData operator()(const v::IVec<N> &coord) {
-    return cache.findAndRun(coord,
-                            [this, &coord](BData &v, bool isNew) -> BData {
-                              if (isNew) {
-                                v = terGen(coord);
-                              }
-                              return v;
-                            });
-  }
-
-  BData *peek(const v::IVec<N> &coord) const {
-    return cache.runIfFound(coord, [](BData &v) -> BData * { return &v; },
-                            nullptr);
+  /// Tells SliceEviction where the slice is now and how far it sees. Does
+  /// nothing with the other Eviction policies.
+  void setSlice(const SliceDirs<N> &sd, double range) {
+    setSliceOf(cache, sd, range, 0);
+  }
+
+  /// Brick hits, misses and evictions so far, to compare Eviction policies.
+  /// The rest of TableStats needs HYPERVOXEL_CHTBL_STATS, see there.
+  TableStats stats() const { return cache.stats(); }
+
+  /// how many misses so far waited for another thread generating the same
+  /// brick, instead of generating it again
+  std::uint64_t generationWaits() const { return inFlight.waits(); }
+
+  /// how many generated bricks terGen's uniformBox proved all one value, so
+  /// they were filled with it instead of generated block by block
+  std::uint64_t uniformBricks() const {
+    return uniform.load(std::memory_order_relaxed);
+  }
+
+  /// all zero without a cold tier
+  ColdTierStats coldTierStats() const {
+    return cold ? cold->stats() : ColdTierStats{0, 0, 0, 0, 0, 0};
+  }
+
+  /// Lock-free, see ConcurrentCacher::readIfFound. False if coord's brick
+  /// is not cached.
+  bool peek(const v::IVec<N> &coord, BData &out) {
+    return cache.readIfFound(Brick::keyOf(coord),
+                             [&out, &coord](Brick &b) -> bool {
+                               out = b[coord];
+                               return true;
+                             },
+                             false);
   }
 };
 
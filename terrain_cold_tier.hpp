@@ -0,0 +1,193 @@
+#ifndef HYPERVOXEL_TERRAIN_COLD_TIER_HPP_
+#define HYPERVOXEL_TERRAIN_COLD_TIER_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "concurrent_hashtable.hpp"
+#include "vector.hpp"
+
+namespace hypervoxel {
+
+/// what a TerrainColdTier did so far, and what a block costs in each tier
+struct ColdTierStats {
+  std::uint64_t demoted;   /// evicted bricks stored in the cold tier
+  std::uint64_t uniform;   /// of those, bricks stored as their single value
+  std::uint64_t dropped;   /// evicted bricks left out as the queue was full
+  std::uint64_t promoted;  /// bricks handed back to the hot tier
+  double hotBitsPerBlock;  /// of a hot table slot, key included
+  double coldBitsPerBlock; /// of the cold slots demoted bricks took so far
+};
+
+/**
+  Second tier of a TerrainCache, for the bricks its hot tier evicts. An
+  evicted brick is only copied into a bounded queue, or dropped if that is
+  full, and a background thread at idle priority stores it: a brick of a
+  single value, as all air and all solid ones are, as just that value, and
+  the others as they are, which with bit blockdata already takes a bit per
+  block. promote hands a brick back, so that a TerrainPrefetcher worker
+  moves it into the hot tier instead of generating it again, and drops it
+  from the cold tier, so the two never hold the same brick for long.
+*/
+template <std::size_t N, class Brick> class TerrainColdTier {
+
+  typedef decltype(std::declval<const Brick &>().get(0)) BData;
+  static_assert(std::is_trivially_copyable<BData>::value,
+                "TerrainColdTier compares blockdata by its bytes");
+
+  template <class V>
+  using cacher = ClockCacher<v::IVec<N>, V, v::IVecHash<N>,
+                             v::EqualFunctor<v::IVec<N>, v::IVec<N>>>;
+
+  cacher<BData> uniforms;
+  cacher<Brick> mixed;
+
+  std::mutex queueMutex;
+  std::condition_variable queueCond;
+  std::unique_ptr<std::pair<v::IVec<N>, Brick>[]> queue;
+  std::size_t queueSize, head, tail;
+  bool stop;
+
+  std::atomic<std::uint64_t> demoted, uniform, dropped, promoted;
+
+  std::thread worker;
+
+  /// SCHED_IDLE where the OS has it, like TerrainPrefetcher's workers
+  static void lowerPriority() {
+#ifdef SCHED_IDLE
+    sched_param param{};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+  }
+
+  /// whether every block of brick is val, which is set to its first one
+  static bool isUniform(const Brick &brick, BData &val) {
+    val = brick.get(0);
+    for (std::size_t i = 1; i < Brick::volume; i++) {
+      BData other = brick.get(i);
+      if (std::memcmp(&val, &other, sizeof(BData))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void work() {
+    lowerPriority();
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while (true) {
+      queueCond.wait(lock, [this]() -> bool { return stop || head != tail; });
+      if (stop) {
+        return;
+      }
+      std::pair<v::IVec<N>, Brick> got = queue[head++ % queueSize];
+      lock.unlock();
+      BData val;
+      if (isUniform(got.second, val)) {
+        mixed.erase(got.first);
+        uniforms.insertAndRun(got.first,
+                              [&val](BData &v, bool) -> void { v = val; });
+        uniform.fetch_add(1, std::memory_order_relaxed);
+      } else {
+        uniforms.erase(got.first);
+        mixed.insertAndRun(got.first, [&got](Brick &b, bool) -> void {
+          b = got.second;
+        });
+      }
+      demoted.fetch_add(1, std::memory_order_relaxed);
+      lock.lock();
+    }
+  }
+
+public:
+  /// Holds about size bricks of a single value, and size more of the
+  /// others. At most queueSize evicted bricks wait to be stored.
+  TerrainColdTier(std::size_t size, std::size_t queueSize)
+      : uniforms(ceilLog2(size) + 1, size / 2, size / 2,
+                 TableAlloc::zeroPages),
+        mixed(ceilLog2(size) + 1, size / 2, size / 2, TableAlloc::zeroPages),
+        queue(new std::pair<v::IVec<N>, Brick>[queueSize]),
+        queueSize(queueSize), head(0), tail(0), stop(false), demoted{0},
+        uniform{0}, dropped{0}, promoted{0},
+        worker(&TerrainColdTier::work, this) {}
+
+  ~TerrainColdTier() {
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      stop = true;
+    }
+    queueCond.notify_all();
+    worker.join();
+  }
+
+  /// Queues brick, just evicted from key, to be stored in the cold tier.
+  /// Only wakes the worker if the queue was empty, so a flip handing over
+  /// a whole table does not wake it for every brick.
+  void demote(const v::IVec<N> &key, const Brick &brick) {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    if (tail - head == queueSize) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    bool wasEmpty = head == tail;
+    queue[tail++ % queueSize] = {key, brick};
+    lock.unlock();
+    if (wasEmpty) {
+      queueCond.notify_one();
+    }
+  }
+
+  /// Copies the brick at key into brick and drops it from the cold tier, if
+  /// that has it, returning whether it did. The lookups are lock-free.
+  bool promote(const v::IVec<N> &key, Brick &brick) {
+    BData val;
+    if (uniforms.readIfFound(key,
+                             [&val](BData &v) -> bool {
+                               val = v;
+                               return true;
+                             },
+                             false)) {
+      brick.fill(val);
+      uniforms.erase(key);
+    } else if (mixed.readIfFound(key,
+                                 [&brick](Brick &b) -> bool {
+                                   brick = b;
+                                   return true;
+                                 },
+                                 false)) {
+      mixed.erase(key);
+    } else {
+      return false;
+    }
+    promoted.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  ColdTierStats stats() const {
+    std::uint64_t d = demoted.load(std::memory_order_relaxed);
+    std::uint64_t u = uniform.load(std::memory_order_relaxed);
+    double volume = Brick::volume;
+    double uniformSlot = sizeof(std::pair<v::IVec<N>, BData>);
+    double mixedSlot = sizeof(std::pair<v::IVec<N>, Brick>);
+    return {d,
+            u,
+            dropped.load(std::memory_order_relaxed),
+            promoted.load(std::memory_order_relaxed),
+            8 * mixedSlot / volume,
+            d ? 8 * (u * uniformSlot + (d - u) * mixedSlot) / (d * volume)
+              : 0};
+  }
+};
+
+} // namespace hypervoxel
+
+#endif // HYPERVOXEL_TERRAIN_COLD_TIER_HPP_
@@ -1,14 +1,37 @@
 #ifndef TERRAIN_GENERATOR_PERLIN_HPP_
 #define TERRAIN_GENERATOR_PERLIN_HPP_
 
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <random>
 #include <type_traits>
 
 #include "primitives.hpp"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HYPERVOXEL_PERLIN_X86
+#endif
+
+/// unrolls the loop that follows, which -O2 would not for the short loops
+/// over dimensions and lanes that TerrainGeneratorPerlin::generateBrick needs
+/// unrolled to keep its vectors in registers
+#if defined(__clang__)
+#define HYPERVOXEL_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__)
+#define HYPERVOXEL_UNROLL _Pragma("GCC unroll 64")
+#else
+#define HYPERVOXEL_UNROLL
+#endif
+
 namespace hypervoxel {
 
 template <std::size_t N> struct BBlockdata {
 
+  /// val is all there is to it, so TerrainCache packs it into one bit
+  typedef void thisisabit;
+
   bool val;
 
   Color getColor(std::size_t dir) const {
@@ -41,6 +64,59 @@ template <std::size_t N> struct BBlockdata {
   bool isVisible() const { return val; }
 };
 
+/// numGradVecs needs to be a power of 2
+inline std::unique_ptr<double[]>
+getGradVecs(std::size_t numGradVecs, std::size_t numDims, unsigned seed) {
+  std::unique_ptr<double[]> gradVecs(new double[numGradVecs * numDims]);
+  std::mt19937 mtrand(seed);
+  double pi2 = 2 * 3.141592653589792653589793238462643383;
+  // assuming numGradVecs is even (which it is)
+  for (std::size_t i = 0; i < numGradVecs * numDims; i += 2) {
+    double u1 = (1 - mtrand() / 4294967296.0);
+    double u2 = (1 - mtrand() / 4294967296.0);
+    double r = std::sqrt(-2 * std::log(u1));
+    gradVecs[i] = r * std::cos(pi2 * u2);
+    gradVecs[i + 1] = r * std::sin(pi2 * u2);
+  }
+  for (std::size_t i = 0; i < numGradVecs; i++) {
+    double norm = 0;
+    for (std::size_t j = 0; j < numDims; j++) {
+      norm += gradVecs[numDims * i + j] * gradVecs[numDims * i + j];
+    }
+    // the likelihood of norm being less than 1e-12 in 3 dimensions
+    // (chi-squared random variable) is insanely small
+    norm = std::sqrt(norm);
+    for (std::size_t j = 0; j < numDims; j++) {
+      gradVecs[numDims * i + j] /= norm;
+    }
+  }
+  return gradVecs;
+}
+
+/// GCC vector types of L doubles, and of the ints that go along with them,
+/// for TerrainGeneratorPerlin::generateBrick
+template <std::size_t L> struct PerlinLanes;
+template <> struct PerlinLanes<2> {
+  typedef double D __attribute__((vector_size(16)));
+  typedef std::int64_t M __attribute__((vector_size(16)));
+  typedef std::int32_t I __attribute__((vector_size(8)));
+  typedef std::uint32_t U __attribute__((vector_size(8)));
+};
+template <> struct PerlinLanes<4> {
+  typedef double D __attribute__((vector_size(32)));
+  typedef std::int64_t M __attribute__((vector_size(32)));
+  typedef std::int32_t I __attribute__((vector_size(16)));
+  typedef std::uint32_t U __attribute__((vector_size(16)));
+};
+
+/// what TerrainGeneratorPerlin::classify did, added up over the calls given
+/// the same stats
+struct OctaveStats {
+  std::uint64_t voxels;         /// voxels classified
+  std::uint64_t octavesRun;     /// octaves summed
+  std::uint64_t octavesSkipped; /// octaves left out, the voxel decided
+};
+
 template <std::size_t N> class TerrainGeneratorPerlin {
 
   struct BitsVec {
@@ -116,9 +192,331 @@ template <std::size_t N> class TerrainGeneratorPerlin {
     }
   };
 
+  /// What get works out along one dimension for one coordinate at one
+  /// octave, which all voxels of a box with that coordinate share.
+  struct AxisTerm {
+    std::int32_t posf;
+    double vec0, lerp;
+  };
+
+  /// The 2^N corner gradients of a lattice cell at one octave, each
+  /// coordinate broadcast to all L lanes. A cell holds (scale / 2^octave)^N
+  /// voxels, which generateBrick then sweeps without hashing again.
+  template <std::size_t L> struct CellGradients {
+    v::IVec<N> cell;
+    bool valid;
+    typename PerlinLanes<L>::D grads[std::size_t(1) << N][N];
+  };
+
+  /**
+    The term octave adds to get for L voxels at once, added times amplitude
+    to the first n of out. The voxels lie along dim 0, and terms[d] points at
+    their AxisTerm along dimension d, those of the n voxels for dim 0. Runs on
+    GCC vector extensions that compile to SSE2 or AVX2 registers depending on
+    the function this is inlined into. Every lane does get's arithmetic in get's
+    order, so the results are the same bits.
+
+    Lanes in one lattice cell, the common case, take their gradients from
+    cached, which is refilled only once they move on to another cell. Lanes
+    spanning cells hash their corners each, sharing the hashes' prefixes
+    over the first N - 1 dimensions, as IVecHash chains them in that order.
+  */
+  template <std::size_t L>
+  __attribute__((always_inline)) inline void
+  octaveLanes(const AxisTerm *const *terms, std::size_t n, std::size_t octave,
+              double amplitude, CellGradients<L> &cached, double *out) const {
+    typedef typename PerlinLanes<L>::D D;
+    typedef typename PerlinLanes<L>::I I;
+    typedef typename PerlinLanes<L>::U U;
+    const std::size_t numCorners = std::size_t(1) << N;
+
+    I posf[N];
+    D vec[2][N], lerp[N];
+    HYPERVOXEL_UNROLL
+    for (std::size_t d = 0; d < N; d++) {
+      std::int32_t lanePosf[L];
+      double laneVec0[L], laneLerp[L];
+      HYPERVOXEL_UNROLL
+      for (std::size_t l = 0; l < L; l++) {
+        const AxisTerm &term = terms[d][d ? 0 : l < n ? l : n - 1];
+        lanePosf[l] = term.posf;
+        laneVec0[l] = term.vec0;
+        laneLerp[l] = term.lerp;
+      }
+      std::memcpy(&posf[d], lanePosf, sizeof(I));
+      std::memcpy(&vec[0][d], laneVec0, sizeof(D));
+      std::memcpy(&lerp[d], laneLerp, sizeof(D));
+      vec[1][d] = vec[0][d] - 1.;
+    }
+
+    bool oneCell = posf[0][0] == posf[0][L - 1];
+    bool hit = oneCell && cached.valid;
+    HYPERVOXEL_UNROLL
+    for (std::size_t d = 0; d < N; d++) {
+      hit = hit && cached.cell[d] == posf[d][0];
+    }
+    D corners[numCorners];
+    if (!hit) {
+      U hashes[numCorners] = {};
+      HYPERVOXEL_UNROLL
+      for (std::size_t d = 0; d < N; d++) {
+        std::size_t bit = std::size_t(1) << d;
+        HYPERVOXEL_UNROLL
+        for (std::size_t c = 0; c < bit; c++) {
+          U prefix = hashes[c];
+          HYPERVOXEL_UNROLL
+          for (std::size_t b = 0; b < 2; b++) {
+            U val = __builtin_convertvector(posf[d] + std::int32_t(b), U);
+            val *= 0xcc9e2d51;
+            val = (val << 15) | (val >> 17);
+            val *= 0x1b873593;
+            U h = prefix ^ val;
+            if (d + 1 < N) {
+              h = (h << 13) | (h >> 19);
+              h = h * 5 + 0xe6546b64;
+            }
+            hashes[c | (b ? bit : 0)] = h;
+          }
+        }
+      }
+      HYPERVOXEL_UNROLL
+      for (std::size_t c = 0; c < numCorners; c++) {
+        U inds = (hashes[c] + std::uint32_t(octave)) &
+                 std::uint32_t(options.numGradVecsMask);
+        const double *gvecs[L];
+        HYPERVOXEL_UNROLL
+        for (std::size_t l = 0; l < L; l++) {
+          gvecs[l] = options.gradVecs + N * inds[oneCell ? 0 : l];
+        }
+        HYPERVOXEL_UNROLL
+        for (std::size_t d = 0; d < N; d++) {
+          D g;
+          HYPERVOXEL_UNROLL
+          for (std::size_t l = 0; l < L; l++) {
+            g[l] = gvecs[l][d];
+          }
+          if (oneCell) {
+            cached.grads[c][d] = g;
+          }
+          D term = vec[(c >> d) & 1][d] * g;
+          corners[c] = d ? corners[c] + term : term;
+        }
+      }
+      if (oneCell) {
+        HYPERVOXEL_UNROLL
+        for (std::size_t d = 0; d < N; d++) {
+          cached.cell[d] = posf[d][0];
+        }
+        cached.valid = true;
+      }
+    } else {
+      HYPERVOXEL_UNROLL
+      for (std::size_t c = 0; c < numCorners; c++) {
+        HYPERVOXEL_UNROLL
+        for (std::size_t d = 0; d < N; d++) {
+          D term = vec[(c >> d) & 1][d] * cached.grads[c][d];
+          corners[c] = d ? corners[c] + term : term;
+        }
+      }
+    }
+    HYPERVOXEL_UNROLL
+    for (std::size_t j = 0; j < N; j++) {
+      std::size_t half = numCorners >> (j + 1);
+      HYPERVOXEL_UNROLL
+      for (std::size_t c = 0; c < half; c++) {
+        corners[c] = corners[c] + lerp[j] * (corners[c + half] - corners[c]);
+      }
+    }
+    D term = corners[0] * amplitude;
+    for (std::size_t l = 0; l < n; l++) {
+      out[l] += term[l];
+    }
+  }
+
+  /// generateBrick with L lanes, see there. Goes through the box once per
+  /// octave, so each octave's cached cell lasts for all the voxels in it,
+  /// and works out the octave's AxisTerms for each dimension up front.
+  template <std::size_t L>
+  __attribute__((always_inline)) inline void
+  generateLanes(const v::IVec<N> &origin, const v::IVec<N> &extent,
+                double *out) const {
+    std::size_t volume = 1, axesSize = 0;
+    for (std::size_t d = N; d--;) {
+      volume *= extent[d];
+      axesSize += extent[d];
+    }
+    for (std::size_t i = volume; i--;) {
+      out[i] = 0;
+    }
+    std::unique_ptr<AxisTerm[]> axes(new AxisTerm[axesSize]);
+    CellGradients<L> cached = {};
+    double amplitude = 1;
+    for (std::size_t octave = options.numOctaves; octave--;) {
+      const AxisTerm *terms[N];
+      AxisTerm *axis = axes.get();
+      for (std::size_t d = 0; d < N; d++) {
+        terms[d] = axis;
+        for (std::int32_t k = 0; k < extent[d]; k++, axis++) {
+          double pos = (double(origin[d] + k) + 0.5) / options.scale[d];
+          for (std::size_t i = options.numOctaves - 1; i > octave; i--) {
+            pos *= 2.;
+          }
+          axis->posf = pos;
+          axis->posf -= axis->posf > pos;
+          axis->vec0 = pos - axis->posf;
+          axis->lerp = axis->vec0 * axis->vec0 * (3. - 2. * axis->vec0);
+        }
+      }
+      cached.valid = false;
+      v::IVec<N> row;
+      for (std::size_t d = N; d--;) {
+        row[d] = cached.cell[d] = 0;
+      }
+      double *rowOut = out;
+      while (true) {
+        for (std::int32_t x = 0; x < extent[0]; x += std::int32_t(L)) {
+          std::size_t n = extent[0] - x < std::int32_t(L) ? extent[0] - x : L;
+          octaveLanes<L>(terms, n, octave, amplitude, cached, rowOut);
+          terms[0] += n;
+          rowOut += n;
+        }
+        terms[0] -= extent[0];
+        std::size_t d = 1;
+        for (; d < N && ++row[d] == extent[d]; d++) {
+          terms[d] -= row[d] - 1;
+          row[d] = 0;
+        }
+        if (d == N) {
+          break;
+        }
+        terms[d]++;
+      }
+      amplitude *= options.persistence;
+    }
+  }
+
+  /// the term octave adds to get at pos, before its amplitude
+  double octaveAt(const v::DVec<N> &pos, std::size_t octave) const {
+    v::IVec<N> posf = v::DVecFloor<N>{pos};
+    v::DVec<N> vec0 = pos - v::toDVec(posf);
+    v::DVec<N> vec1 = vec0 - 1.;
+    v::DVec<N> lerp = vec0 * vec0 * (3. - 2. * vec0);
+    return LerperT<1, N - 1, GetResult>{}(GetResult{options.gradVecs,
+                                                    options.numGradVecsMask,
+                                                    octave,
+                                                    posf,
+                                                    {vec0.data, vec1.data}},
+                                          lerp)[0];
+  }
+
+  /// get's pos, at the coarsest octave, of the box's first and last voxels
+  void boxPositions(const v::IVec<N> &origin, const v::IVec<N> &extent,
+                    v::DVec<N> &plo, v::DVec<N> &phi) const {
+    plo = (v::toDVec(origin) + 0.5) / options.scale;
+    phi = (v::toDVec(origin + extent - 1) + 0.5) / options.scale;
+  }
+
+  /// adds the bounds olo and ohi times amplitude to lo and hi
+  static void addScaled(double olo, double ohi, double amplitude, double &lo,
+                        double &hi) {
+    lo += (amplitude < 0 ? ohi : olo) * amplitude;
+    hi += (amplitude < 0 ? olo : ohi) * amplitude;
+  }
+
+  /**
+    Bounds, into lo and hi, on the term octave adds to get, before its
+    amplitude, anywhere in the box from plo to phi at that octave's scale.
+    Each lattice cell the box spans is bounded on its own. In a cell, get
+    lerps the corners' dot products, and a dot product is its value at the
+    centre of the box clipped to the cell, give or take its gradient's L1
+    norm weighted by the clipped box's half widths. The lerps of what is
+    given or taken stay within the largest of them, and the lerps of the
+    centre values are multilinear in the lerp weights, which smoothstep
+    keeps monotone, so those are bounded by trying every combination of the
+    weights' lowest and highest.
+  */
+  void octaveBounds(const v::DVec<N> &plo, const v::DVec<N> &phi,
+                    std::size_t octave, double &lo, double &hi) const {
+    static const std::size_t numCorners = std::size_t(1) << N;
+    v::IVec<N> cellLo = v::DVecFloor<N>{plo}, cellHi = v::DVecFloor<N>{phi};
+    v::IVec<N> cell = cellLo;
+    lo = HUGE_VAL;
+    hi = -HUGE_VAL;
+    while (true) {
+      // offsets from the cell's low corner, and lerp weights, in the box
+      double tlo[N], thi[N], slo[N], shi[N];
+      for (std::size_t d = N; d--;) {
+        tlo[d] = cell[d] == cellLo[d] ? plo[d] - cell[d] : 0;
+        thi[d] = cell[d] == cellHi[d] ? phi[d] - cell[d] : 1;
+        slo[d] = tlo[d] * tlo[d] * (3. - 2. * tlo[d]);
+        shi[d] = thi[d] * thi[d] * (3. - 2. * thi[d]);
+      }
+      // each corner's dot product, at the clipped box's centre, and how far
+      // it gets from that in the box
+      double centre[numCorners], reach = 0;
+      for (std::size_t c = 0; c < numCorners; c++) {
+        const v::IVec<N> bits = BitsVec{c};
+        const double *gvec =
+            options.gradVecs +
+            N * ((v::IVecHash<N>{}(cell + bits) + octave) &
+                 options.numGradVecsMask);
+        double r = 0;
+        centre[c] = 0;
+        for (std::size_t d = 0; d < N; d++) {
+          centre[c] += gvec[d] * ((tlo[d] + thi[d]) / 2 - bits[d]);
+          r += std::fabs(gvec[d]) * (thi[d] - tlo[d]) / 2;
+        }
+        reach = r > reach ? r : reach;
+      }
+      // the lerps of the centres are multilinear in the weights, so their
+      // extremes are at the corners of the weights' box
+      for (std::size_t w = 0; w < numCorners; w++) {
+        double folded[numCorners];
+        std::memcpy(folded, centre, sizeof(folded));
+        for (std::size_t j = 0; j < N; j++) {
+          std::size_t half = numCorners >> (j + 1);
+          double s = (w >> j) & 1 ? shi[j] : slo[j];
+          for (std::size_t c = 0; c < half; c++) {
+            folded[c] += s * (folded[c + half] - folded[c]);
+          }
+        }
+        lo = folded[0] - reach < lo ? folded[0] - reach : lo;
+        hi = folded[0] + reach > hi ? folded[0] + reach : hi;
+      }
+
+      std::size_t d = 0;
+      for (; d < N && cell[d] == cellHi[d]; d++) {
+        cell[d] = cellLo[d];
+      }
+      if (d == N) {
+        return;
+      }
+      cell[d]++;
+    }
+  }
+
+#ifdef HYPERVOXEL_PERLIN_X86
+  __attribute__((target("avx2"))) void
+  generateAvx2(const v::IVec<N> &origin, const v::IVec<N> &extent,
+               double *out) const {
+    generateLanes<4>(origin, extent, out);
+  }
+#endif
+
 public:
   typedef BBlockdata<N> blockdata;
 
+  /// get above this is solid
+  static constexpr double threshold = 0.3;
+
+  /// How far an octave of unit gradient vectors, as getGradVecs makes them,
+  /// gets from 0 at most. An octave is a convex combination of its corners'
+  /// dot products, and a corner's offset is at most sqrt(N) long, as each
+  /// coordinate of it is in [-1, 1]. The lerps do not pair each dimension's
+  /// weight with that dimension's corners, so the sqrt(N) / 2 of textbook
+  /// Perlin noise does not hold here.
+  static double octaveBound() { return std::sqrt(double(N)); }
+
   struct Options {
     v::DVec<N> scale;
     double *gradVecs;
@@ -128,7 +526,172 @@ public:
   } options;
 
   blockdata operator()(const v::IVec<N> &coord) const {
-    return {get(coord) > 0.3};
+    OctaveStats stats = {};
+    return classify(coord, stats);
+  }
+
+  /**
+    {get(coord) > threshold}, but summing octaves only until that is decided:
+    get goes from the coarsest octave, of amplitude 1, to the finer ones, and
+    once the total is further from threshold than octaveBound times the
+    amplitudes left, the finer octaves are skipped. A little slack covers
+    the rounding of what they would have added, so the result is always
+    operator()'s and get's. Needs gradient vectors of length at most 1.
+    Adds what it did to stats.
+  */
+  blockdata classify(const v::IVec<N> &coord, OctaveStats &stats) const {
+    static const double slack = 1e-9;
+    double left = 0;
+    double amplitude = 1;
+    for (std::size_t i = options.numOctaves; i--;) {
+      left += std::fabs(amplitude);
+      amplitude *= options.persistence;
+    }
+    double total = 0;
+    amplitude = 1;
+    v::DVec<N> pos = (v::toDVec(coord) + 0.5) / options.scale;
+    std::size_t run = 0;
+    for (std::size_t i = options.numOctaves; i--;) {
+      total += octaveAt(pos, i) * amplitude;
+      run++;
+      left -= std::fabs(amplitude);
+      if (std::fabs(total - threshold) > left * octaveBound() + slack) {
+        break;
+      }
+      amplitude *= options.persistence;
+      pos *= 2.;
+    }
+    stats.voxels++;
+    stats.octavesRun += run;
+    stats.octavesSkipped += options.numOctaves - run;
+    return {total > threshold};
+  }
+
+  /// Tells terrain from different options apart, for TerrainStore. FNV-1a
+  /// over the options and the gradient vectors they point to.
+  std::uint64_t seed() const {
+    std::uint64_t h = 0xcbf29ce484222325ULL;
+    auto mix = [&h](const void *data, std::size_t len) -> void {
+      const unsigned char *bytes = static_cast<const unsigned char *>(data);
+      for (std::size_t i = 0; i < len; i++) {
+        h = (h ^ bytes[i]) * 0x100000001b3ULL;
+      }
+    };
+    std::uint64_t n = N;
+    mix(&n, sizeof(n));
+    mix(&options.scale[0], N * sizeof(double));
+    mix(options.gradVecs, (options.numGradVecsMask + 1) * N * sizeof(double));
+    mix(&options.numOctaves, sizeof(options.numOctaves));
+    mix(&options.persistence, sizeof(options.persistence));
+    return h;
+  }
+
+  /**
+    get for every coord in the box from origin spanning extent, into out,
+    with coord[0] varying fastest, then coord[1] and so on, which is
+    TerrainBrick's order for a brick-shaped box. Rows along dim 0 go through
+    a few voxels at once in SIMD registers: 4 with AVX2, where the CPU has
+    it, and 2 otherwise (SSE2 on x86, whatever the compiler lowers GCC
+    vectors to elsewhere). Each octave hashes and loads the corner gradients
+    of a lattice cell once for all the voxels in it, instead of per voxel.
+    The results are the same as get's, bit for bit.
+  */
+  void generateBrick(const v::IVec<N> &origin, const v::IVec<N> &extent,
+                     double *out) const {
+#ifdef HYPERVOXEL_PERLIN_X86
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    if (hasAvx2) {
+      generateAvx2(origin, extent, out);
+      return;
+    }
+#endif
+    generateLanes<2>(origin, extent, out);
+  }
+
+  /// generateBrick into blockdata, thresholded like operator()
+  void generateBrick(const v::IVec<N> &origin, const v::IVec<N> &extent,
+                     blockdata *out) const {
+    static const std::size_t stackVolume = 1024;
+    std::size_t volume = 1;
+    for (std::size_t d = N; d--;) {
+      volume *= extent[d];
+    }
+    double stackVals[stackVolume];
+    std::unique_ptr<double[]> heapVals(
+        volume > stackVolume ? new double[volume] : nullptr);
+    double *vals = heapVals ? heapVals.get() : stackVals;
+    generateBrick(origin, extent, vals);
+    for (std::size_t i = volume; i--;) {
+      out[i] = {vals[i] > threshold};
+    }
+  }
+
+  /**
+    Bounds, into lo and hi, on get anywhere in the box from origin spanning
+    extent: the sum over octaves of octaveBounds times the amplitude. The
+    bounds are a little loose, and more so for boxes spanning many lattice
+    cells at the finest octave.
+  */
+  void boundBox(const v::IVec<N> &origin, const v::IVec<N> &extent,
+                double &lo, double &hi) const {
+    v::DVec<N> plo, phi;
+    boxPositions(origin, extent, plo, phi);
+    lo = hi = 0;
+    double amplitude = 1;
+    for (std::size_t i = options.numOctaves; i--;) {
+      double olo, ohi;
+      octaveBounds(plo, phi, i, olo, ohi);
+      addScaled(olo, ohi, amplitude, lo, hi);
+      amplitude *= options.persistence;
+      plo *= 2.;
+      phi *= 2.;
+    }
+  }
+
+  /**
+    Whether every block in the box from origin spanning extent is provably
+    the same, into out if it is, without getting any of them. Octaves are
+    bounded as in boundBox, coarsest first, and the finer ones are left out
+    as soon as the box is decided, or as soon as it provably cannot be, given
+    octaveBound. Where it returns true, generateBrick and operator() make
+    every block out, but it misses some uniform boxes, mostly those close
+    to the threshold. Needs gradient vectors of length at most 1.
+  */
+  bool uniformBox(const v::IVec<N> &origin, const v::IVec<N> &extent,
+                  blockdata &out) const {
+    static const double slack = 1e-9;
+    double left = 0;
+    double amplitude = 1;
+    for (std::size_t i = options.numOctaves; i--;) {
+      left += std::fabs(amplitude);
+      amplitude *= options.persistence;
+    }
+    v::DVec<N> plo, phi;
+    boxPositions(origin, extent, plo, phi);
+    double lo = 0, hi = 0;
+    amplitude = 1;
+    for (std::size_t i = options.numOctaves; i--;) {
+      double olo, ohi;
+      octaveBounds(plo, phi, i, olo, ohi);
+      addScaled(olo, ohi, amplitude, lo, hi);
+      left -= std::fabs(amplitude);
+      double rest = left * octaveBound() + slack;
+      if (lo - rest > threshold) {
+        out = {true};
+        return true;
+      }
+      if (hi + rest < threshold) {
+        out = {false};
+        return true;
+      }
+      if (lo + rest <= threshold && hi - rest >= threshold) {
+        return false;
+      }
+      amplitude *= options.persistence;
+      plo *= 2.;
+      phi *= 2.;
+    }
+    return false;
   }
 
   double get(const v::IVec<N> &coord) const {
@@ -136,17 +699,7 @@ public:
     double amplitude = 1;
     v::DVec<N> pos = (v::toDVec(coord) + 0.5) / options.scale;
     for (std::size_t i = options.numOctaves; i--;) {
-      v::IVec<N> posf = v::DVecFloor<N>{pos};
-      v::DVec<N> vec0 = pos - v::toDVec(posf);
-      v::DVec<N> vec1 = vec0 - 1.;
-      v::DVec<N> lerp = vec0 * vec0 * (3. - 2. * vec0);
-      total += LerperT<1, N - 1, GetResult>{}(GetResult{options.gradVecs,
-                                                        options.numGradVecsMask,
-                                                        i,
-                                                        posf,
-                                                        {vec0.data, vec1.data}},
-                                              lerp)[0] *
-               amplitude;
+      total += octaveAt(pos, i) * amplitude;
       amplitude *= options.persistence;
       pos *= 2.;
     }
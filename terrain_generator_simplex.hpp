@@ -0,0 +1,99 @@
+#ifndef HYPERVOXEL_TERRAIN_GENERATOR_SIMPLEX_HPP_
+#define HYPERVOXEL_TERRAIN_GENERATOR_SIMPLEX_HPP_
+
+#include <cmath>
+#include <cstdint>
+
+#include "terrain_generator_perlin.hpp"
+
+namespace hypervoxel {
+
+/**
+  Simplex noise terrain, a drop-in for TerrainGeneratorPerlin: same Options,
+  blockdata and operator(). Space is skewed so the lattice cubes split into
+  N! simplices, and each octave only sums the N + 1 corners of the simplex
+  a voxel lies in, each corner's gradient falling off radially, where Perlin
+  lerps all 2^N corners of the cube. Corner gradients are picked the way
+  Perlin picks them, by IVecHash of the corner plus the octave.
+
+  The noise is scaled to about the RMS of Perlin's in the same dimension, so
+  operator()'s threshold gives terrain of a similar look. Simplex noise has
+  heavier tails, though, so from N = 5 up it fills less of space than
+  Perlin does at the same threshold.
+*/
+template <std::size_t N> class TerrainGeneratorSimplex {
+
+  /// the squared radius of each corner's falloff
+  static constexpr double radius2 = 0.5;
+
+  static double skew() { return (std::sqrt(N + 1.) - 1) / N; }
+  static double unskew() { return (1 - 1 / std::sqrt(N + 1.)) / N; }
+
+  /// scales the sum of the corners to spread like Perlin's in N dimensions,
+  /// fitted by sampling N = 2 to 8
+  static double normalization() { return 32 * std::pow(2., N / 2.); }
+
+public:
+  typedef BBlockdata<N> blockdata;
+  typedef typename TerrainGeneratorPerlin<N>::Options Options;
+
+  Options options;
+
+  blockdata operator()(const v::IVec<N> &coord) const {
+    return {get(coord) > TerrainGeneratorPerlin<N>::threshold};
+  }
+
+  /// Like TerrainGeneratorPerlin::seed, and different from it for the same
+  /// options.
+  std::uint64_t seed() const {
+    TerrainGeneratorPerlin<N> perlin;
+    perlin.options = options;
+    return perlin.seed() ^ 0x73696d706c6578ULL;
+  }
+
+  double get(const v::IVec<N> &coord) const {
+    const double g = unskew();
+    double total = 0;
+    double amplitude = 1;
+    v::DVec<N> pos = (v::toDVec(coord) + 0.5) / options.scale;
+    for (std::size_t i = options.numOctaves; i--;) {
+      v::IVec<N> corner = v::DVecFloor<N>{pos + v::sum(pos) * skew()};
+      v::DVec<N> vec = pos - (v::toDVec(corner) - v::sum(corner) * g);
+      std::size_t order[N];
+      for (std::size_t d = 0; d < N; d++) {
+        std::size_t rank = 0;
+        for (std::size_t e = 0; e < N; e++) {
+          rank += vec[e] > vec[d] || (vec[e] == vec[d] && e < d);
+        }
+        order[rank] = d;
+      }
+
+      double noise = 0;
+      for (std::size_t k = 0; k <= N; k++) {
+        if (k) {
+          corner[order[k - 1]]++;
+          vec += g;
+          vec[order[k - 1]] -= 1;
+        }
+        double falloff = radius2 - v::norm2(vec);
+        if (falloff <= 0) {
+          continue;
+        }
+        v::DVec<N> gvec{
+            options.gradVecs +
+            N * ((v::IVecHash<N>{}(corner) + i) & options.numGradVecsMask)};
+        falloff *= falloff;
+        noise += falloff * falloff * v::dot(gvec, vec);
+      }
+
+      total += noise * amplitude;
+      amplitude *= options.persistence;
+      pos *= 2.;
+    }
+    return total * normalization();
+  }
+};
+
+} // namespace hypervoxel
+
+#endif // HYPERVOXEL_TERRAIN_GENERATOR_SIMPLEX_HPP_
@@ -9,6 +9,9 @@ namespace hypervoxel {
 
 template <std::size_t N> struct BoolBlockdata {
 
+  /// val is all there is to it, so TerrainCache packs it into one bit
+  typedef void thisisabit;
+
   bool val;
 
   Color getColor(std::size_t dir) const {
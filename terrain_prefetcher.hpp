@@ -0,0 +1,215 @@
+#ifndef HYPERVOXEL_TERRAIN_PREFETCHER_HPP_
+#define HYPERVOXEL_TERRAIN_PREFETCHER_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+
+#include "primitives.hpp"
+
+namespace hypervoxel {
+
+/// what a TerrainPrefetcher did so far
+struct PrefetchStats {
+  std::uint64_t queued;    /// bricks handed to the workers
+  std::uint64_t dropped;   /// updates that filled the queue before the end
+                           /// of their walk
+  std::uint64_t generated; /// bricks the workers generated or promoted
+};
+
+/**
+  Generates the bricks of a TerrainCache that the next frames are about to
+  read, in background threads, so LineFollowers find them cached instead of
+  generating them themselves mid-frame.
+
+  update takes each frame's SliceDirs. It keeps a smoothed camera velocity,
+  moves the camera ahead by lookahead frames of it, and walks the view
+  frustum in the slice from there, nearest first, queueing every brick it
+  crosses that is not cached yet, for the workers to generate or take back
+  from the cache's cold tier. Each update replaces what the last one queued,
+  and what does not fit in the bounded queue is dropped, so neither stale
+  predictions nor a fast camera can pile up work. The workers run at idle
+  priority where the OS has one (SCHED_IDLE), so they only get the cores
+  the render threads leave free.
+*/
+template <std::size_t N, class TerCache> class TerrainPrefetcher {
+
+  typedef typename TerCache::Brick Brick;
+
+  TerCache &terCache;
+  double lookahead;
+
+  std::mutex queueMutex;
+  std::condition_variable queueCond;
+  std::unique_ptr<v::IVec<N>[]> queue;
+  std::size_t capacity, head, tail;
+  bool stop;
+
+  /// what update fills without queueMutex, then swaps with queue
+  std::unique_ptr<v::IVec<N>[]> next;
+  /// Open addressing set of the keys in next, as indices into it, capacity
+  /// if empty. At least twice capacity long, so it is at most half full.
+  std::unique_ptr<std::uint32_t[]> seen;
+  std::size_t seenBits;
+
+  v::DVec<N> lastCam, velocity;
+  bool hasLastCam;
+
+  std::atomic<std::uint64_t> queued, dropped, generated;
+
+  std::size_t numThreads;
+  std::unique_ptr<std::thread[]> threads;
+
+  static void lowerPriority() {
+#ifdef SCHED_IDLE
+    sched_param param{};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+  }
+
+  static std::size_t bitsFor(std::size_t capacity) {
+    std::size_t bits = 1;
+    while ((std::size_t(1) << bits) < 2 * capacity) {
+      bits++;
+    }
+    return bits;
+  }
+
+  /// Puts key in next[n++], unless it is there already or cached. Returns
+  /// false if it had to be left out because next is full.
+  bool add(const v::IVec<N> &key, std::size_t &n) {
+    std::uint64_t h =
+        std::uint64_t(v::IVecHash<N>{}(key)) * 0x9e3779b97f4a7c15ULL;
+    std::size_t mask = (std::size_t(1) << seenBits) - 1;
+    std::size_t i = h >> (64 - seenBits);
+    for (; seen[i] != capacity; i = (i + 1) & mask) {
+      if (next[seen[i]] == key) {
+        return true;
+      }
+    }
+    if (terCache.hasBrick(key)) {
+      return true;
+    }
+    if (n == capacity) {
+      return false;
+    }
+    seen[i] = std::uint32_t(n);
+    next[n++] = key;
+    queued.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+
+  void work() {
+    lowerPriority();
+    std::unique_lock<std::mutex> lock(queueMutex);
+    while (true) {
+      queueCond.wait(lock, [this]() -> bool { return stop || head != tail; });
+      if (stop) {
+        return;
+      }
+      v::IVec<N> key = queue[head++];
+      lock.unlock();
+      if (terCache.ensureBrick(key)) {
+        generated.fetch_add(1, std::memory_order_relaxed);
+      }
+      lock.lock();
+    }
+  }
+
+public:
+  /// capacity bricks at most are queued per update, lookahead is in frames
+  TerrainPrefetcher(TerCache &terCache, std::size_t numThreads,
+                    std::size_t capacity = 4096, double lookahead = 2)
+      : terCache(terCache), lookahead(lookahead),
+        queue(new v::IVec<N>[capacity]), capacity(capacity), head(0),
+        tail(0), stop(false), next(new v::IVec<N>[capacity]),
+        seen(new std::uint32_t[std::size_t(1) << bitsFor(capacity)]),
+        seenBits(bitsFor(capacity)), hasLastCam(false), queued{0}, dropped{0},
+        generated{0}, numThreads(numThreads),
+        threads(new std::thread[numThreads]) {
+    for (std::size_t i = N; i--;) {
+      velocity[i] = 0;
+    }
+    for (std::size_t i = numThreads; i--;) {
+      threads[i] = std::thread(&TerrainPrefetcher::work, this);
+    }
+  }
+
+  ~TerrainPrefetcher() {
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      stop = true;
+    }
+    queueCond.notify_all();
+    for (std::size_t i = numThreads; i--;) {
+      threads[i].join();
+    }
+  }
+
+  /// Queues the bricks in view dist ahead of where sd.cam is heading, see
+  /// the class comment. Call once per frame, from one thread at a time. The
+  /// walk and its hasBrick probes run without queueMutex, so the workers
+  /// only wait for the new queue to be swapped in.
+  void update(const SliceDirs<N> &sd, double dist) {
+    if (hasLastCam) {
+      velocity = (velocity + (sd.cam - lastCam)) * .5;
+    }
+    lastCam = sd.cam;
+    hasLastCam = true;
+    v::DVec<N> cam = sd.cam + velocity * lookahead;
+
+    std::fill(seen.get(), seen.get() + (std::size_t(1) << seenBits),
+              std::uint32_t(capacity));
+    std::size_t n = 0;
+    bool full = false;
+    double step = Brick::side / 2.;
+    double margin = std::sqrt(double(N));
+    v::IVec<N> lastKey;
+    bool hasLastKey = false;
+    for (double f = -margin; f <= dist + margin && !full; f += step) {
+      double rmax = sd.width2 * (f < 0 ? 0 : f) + margin;
+      double umax = sd.height2 * (f < 0 ? 0 : f) + margin;
+      for (double r = -rmax; r <= rmax && !full; r += step) {
+        for (double u = -umax; u <= umax && !full; u += step) {
+          v::DVec<N> p = cam + sd.forward * f + sd.right * r + sd.up * u;
+          v::IVec<N> key = Brick::keyOf(v::DVecFloor<N>{p});
+          // neighbouring steps mostly land in the same brick
+          if (hasLastKey && key == lastKey) {
+            continue;
+          }
+          lastKey = key;
+          hasLastKey = true;
+          full = !add(key, n);
+        }
+      }
+    }
+    if (full) {
+      dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      queue.swap(next);
+      head = 0;
+      tail = n;
+    }
+    queueCond.notify_all();
+  }
+
+  PrefetchStats stats() const {
+    return {queued.load(std::memory_order_relaxed),
+            dropped.load(std::memory_order_relaxed),
+            generated.load(std::memory_order_relaxed)};
+  }
+};
+
+} // namespace hypervoxel
+
+#endif // HYPERVOXEL_TERRAIN_PREFETCHER_HPP_
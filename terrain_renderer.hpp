@@ -7,30 +7,39 @@
 #include "faces_manager.hpp"
 #include "line_follower.hpp"
 #include "terrain_cache.hpp"
+#include "terrain_prefetcher.hpp"
 #include "terrain_slicer.hpp"
 
 namespace hypervoxel {
 
-template <std::size_t N, class TerGen> class TerrainRenderer {
+template <std::size_t N, class TerGen, class Eviction = FlipEviction>
+class TerrainRenderer {
 
-  TerrainCache<N, TerGen> terCache;
+  typedef TerrainCache<N, TerGen, Eviction> TerCache;
+
+  TerCache terCache;
+  std::unique_ptr<TerrainPrefetcher<N, TerCache>> prefetcher;
   std::unique_ptr<Line<N>[]> lines;
   std::size_t numThreads;
   std::unique_ptr<double[]> dists;
 
   FacesManager<N> facesManager;
-  std::unique_ptr<
-      typename LineFollower<N, TerrainCache<N, TerGen>>::Controller[]>
-      controllers;
+  std::unique_ptr<typename LineFollower<N, TerCache>::Controller[]> controllers;
   std::unique_ptr<std::thread[]> threads;
 
 public:
-  /// pdists decreasing
+  /// pdists decreasing. With numPrefetchThreads, a TerrainPrefetcher
+  /// generates terrain ahead of the camera between frames. terCacheCold is
+  /// the TerrainCache's coldSize, which only the prefetcher reads from.
   TerrainRenderer(TerGen &&tterGen, std::size_t terCacheMin,
                   std::size_t terCacheMax, std::size_t facesManagerSize,
                   std::size_t numThreads, double *pdists,
-                  const SliceDirs<N> &sd)
-      : terCache(std::move(tterGen), terCacheMin, terCacheMax),
+                  const SliceDirs<N> &sd, std::size_t numPrefetchThreads = 0,
+                  std::size_t terCacheCold = 0)
+      : terCache(std::move(tterGen), terCacheMin, terCacheMax, terCacheCold),
+        prefetcher(numPrefetchThreads ? new TerrainPrefetcher<N, TerCache>(
+                                            terCache, numPrefetchThreads)
+                                      : nullptr),
         lines(new Line<N>[((N * (N - 1)) / 2) *
                           static_cast<std::size_t>(
                               (pdists[0] + 5) * (pdists[0] + 5) *
@@ -39,13 +48,13 @@ public:
                               3 * pdists[0])]),
         numThreads(numThreads), dists(new double[numThreads]),
         facesManager(facesManagerSize, facesManagerSize / numThreads, sd.cam),
-        controllers(new typename LineFollower<
-                    N, TerrainCache<N, TerGen>>::Controller[numThreads]()),
+        controllers(
+            new typename LineFollower<N, TerCache>::Controller[numThreads]()),
         threads(new std::thread[numThreads]) {
     std::copy(pdists, pdists + numThreads, dists.get());
     double farDist = pdists[0] + 5;
     for (std::size_t i = numThreads; i--;) {
-      threads[i] = std::thread(LineFollower<N, TerrainCache<N, TerGen>>(
+      threads[i] = std::thread(LineFollower<N, TerCache>(
           0, farDist, terCache, facesManager, controllers[i], numThreads, i));
     }
   }
@@ -59,6 +68,7 @@ public:
 
   float *writeTriangles(const SliceDirs<N> &sd, float *out, float *out_fend) {
     Line<N> *lines_end = getLines(sd, dists[0], lines.get());
+    terCache.setSlice(sd, dists[0]);
     facesManager.setCam(&sd.cam[0]);
     facesManager.clear(); // I need the fence after getLines, yes?
     for (std::size_t i = numThreads; i--;) {
@@ -73,7 +83,26 @@ public:
         std::this_thread::yield();
       }
     }
-    return facesManager.fillVertexAttribPointer(out, out_fend);
+    float *toreturn = facesManager.fillVertexAttribPointer(out, out_fend);
+    if (prefetcher) {
+      prefetcher->update(sd, dists[0]);
+    }
+    return toreturn;
+  }
+
+  /// see TerrainCache::attachStore
+  void attachStore(typename TerCache::Store *store) {
+    terCache.attachStore(store);
+  }
+
+  TableStats terrainCacheStats() const { return terCache.stats(); }
+  ColdTierStats coldTierStats() const { return terCache.coldTierStats(); }
+  std::uint64_t generationWaits() const { return terCache.generationWaits(); }
+  std::uint64_t uniformBricks() const { return terCache.uniformBricks(); }
+  TableStats facesTableStats() const { return facesManager.tableStats(); }
+  /// all zero without numPrefetchThreads
+  PrefetchStats prefetchStats() const {
+    return prefetcher ? prefetcher->stats() : PrefetchStats{0, 0, 0};
   }
 };
 
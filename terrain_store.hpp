@@ -0,0 +1,194 @@
+#ifndef HYPERVOXEL_TERRAIN_STORE_HPP_
+#define HYPERVOXEL_TERRAIN_STORE_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+
+#include "concurrent_hashtable.hpp"
+#include "vector.hpp"
+
+namespace hypervoxel {
+
+/**
+  Bricks a TerrainCache generated, kept on disk so later runs load them
+  instead of generating them again.
+
+  Bricks are grouped into regions of 2^RegionBits bricks along each axis,
+  one file per region, named after the generator seed and the region's
+  coordinate. A file is a Header, a bitmap of the bricks present, and a slot
+  for every brick of the region, and is mapped whole with MAP_SHARED: find
+  hands out pointers straight into the mapping, and save writes into it and
+  then sets the brick's bit. Files whose header does not match the seed or
+  brick size are started over. Regions that cannot be opened or mapped just
+  read as empty, so the cache falls back to generating.
+
+  Brick has to be trivially copyable, as it is stored as its bytes.
+*/
+template <std::size_t N, class Brick, std::size_t RegionBits = 3>
+class TerrainStore {
+  static_assert(std::is_trivially_copyable<Brick>::value,
+                "TerrainStore stores bricks as their bytes");
+
+  static const std::size_t regionBricks = std::size_t(1)
+                                          << (N * RegionBits);
+  static const std::size_t numWords = (regionBricks + 63) / 64;
+  static const std::int32_t regionMask = (1 << RegionBits) - 1;
+  static const std::uint64_t magic = 0x6876726567696f6eULL;
+
+  struct Header {
+    std::uint64_t magic;
+    std::uint64_t seed;
+    std::uint64_t brickBytes;
+    std::uint64_t regionBricks;
+  };
+
+  static const std::size_t bricksOffset =
+      (sizeof(Header) + numWords * 8 + alignof(Brick) - 1) / alignof(Brick) *
+      alignof(Brick);
+  static const std::size_t fileBytes =
+      bricksOffset + regionBricks * sizeof(Brick);
+
+  /// a mapped region file, base is null if it could not be mapped
+  struct Region {
+    char *base = nullptr;
+  };
+
+  typedef ConcurrentHashMap<v::IVec<N>, Region, v::IVecHash<N>,
+                            v::EqualFunctor<v::IVec<N>, v::IVec<N>>>
+      umap;
+
+  std::string dir;
+  std::uint64_t seed;
+  umap regions;
+
+  static v::IVec<N> regionOf(const v::IVec<N> &key) {
+    v::IVec<N> toreturn;
+    for (std::size_t i = N; i--;) {
+      toreturn[i] = key[i] >> RegionBits;
+    }
+    return toreturn;
+  }
+
+  static std::size_t indexOf(const v::IVec<N> &key) {
+    std::size_t toreturn = 0;
+    for (std::size_t i = N; i--;) {
+      toreturn = (toreturn << RegionBits) | (key[i] & regionMask);
+    }
+    return toreturn;
+  }
+
+  std::string pathOf(const v::IVec<N> &region) const {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%016llx",
+                  static_cast<unsigned long long>(seed));
+    std::string toreturn = dir + "/" + buf;
+    for (std::size_t i = 0; i < N; i++) {
+      toreturn += "." + std::to_string(region[i]);
+    }
+    return toreturn + ".region";
+  }
+
+  char *mapRegion(const v::IVec<N> &region) const {
+    int fd = open(pathOf(region).c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+      return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (std::size_t(st.st_size) != fileBytes &&
+                           ftruncate(fd, fileBytes))) {
+      close(fd);
+      return nullptr;
+    }
+    void *mem =
+        mmap(nullptr, fileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+      return nullptr;
+    }
+    Header *h = static_cast<Header *>(mem);
+    if (h->magic != magic || h->seed != seed ||
+        h->brickBytes != sizeof(Brick) || h->regionBricks != regionBricks) {
+      std::memset(mem, 0, bricksOffset);
+      *h = Header{magic, seed, sizeof(Brick), regionBricks};
+    }
+    return static_cast<char *>(mem);
+  }
+
+  char *regionBase(const v::IVec<N> &key) {
+    v::IVec<N> region = regionOf(key);
+    return regions.findAndRun(region,
+                              [this, &region](Region &r, bool isNew) -> char * {
+                                if (isNew) {
+                                  r.base = mapRegion(region);
+                                }
+                                return r.base;
+                              });
+  }
+
+  static std::atomic<std::uint64_t> *presentWords(char *base) {
+    return reinterpret_cast<std::atomic<std::uint64_t> *>(base +
+                                                          sizeof(Header));
+  }
+
+public:
+  /// Stores region files in dir, which is created if missing. seed tells
+  /// terrain from different generators apart, see
+  /// TerrainGeneratorPerlin::seed.
+  TerrainStore(const std::string &dir, std::uint64_t seed)
+      : dir(dir), seed(seed), regions(4) {
+    mkdir(dir.c_str(), 0755);
+  }
+
+  TerrainStore(const TerrainStore &) = delete;
+  TerrainStore &operator=(const TerrainStore &) = delete;
+
+  ~TerrainStore() {
+    regions.forEach([](typename umap::value_type &e) -> bool {
+      if (e.second.base) {
+        munmap(e.second.base, fileBytes);
+      }
+      return true;
+    });
+  }
+
+  /// The stored brick at key, in the mapped file, or null if there is none.
+  const Brick *find(const v::IVec<N> &key) {
+    char *base = regionBase(key);
+    if (!base) {
+      return nullptr;
+    }
+    std::size_t i = indexOf(key);
+    if (!((presentWords(base)[i >> 6].load(std::memory_order_acquire) >>
+           (i & 63)) &
+          1)) {
+      return nullptr;
+    }
+    return reinterpret_cast<const Brick *>(base + bricksOffset) + i;
+  }
+
+  /// Stores brick at key. Concurrent saves of the same key have to write
+  /// the same brick, which generated bricks do.
+  void save(const v::IVec<N> &key, const Brick &brick) {
+    char *base = regionBase(key);
+    if (!base) {
+      return;
+    }
+    std::size_t i = indexOf(key);
+    std::memcpy(base + bricksOffset + i * sizeof(Brick), &brick,
+                sizeof(Brick));
+    presentWords(base)[i >> 6].fetch_or(std::uint64_t(1) << (i & 63),
+                                        std::memory_order_release);
+  }
+};
+
+} // namespace hypervoxel
+
+#endif // HYPERVOXEL_TERRAIN_STORE_HPP_